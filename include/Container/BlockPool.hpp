@@ -0,0 +1,61 @@
+#ifndef hpp_BlockPool_hpp
+#define hpp_BlockPool_hpp
+
+// We need types
+#include "Types.hpp"
+// We need atomic for the lock free bitmap
+#include <atomic>
+#include <cstddef>
+
+namespace Container
+{
+    /** A fixed pool of memory blocks of the same size, allocated with the pool (so there's no heap allocation).
+        A bitmap tracks the used blocks, it's updated atomically, so blocks can be acquired and released from any thread without lock.
+        @param Count    The number of blocks
+        @param Size     The size of each block in bytes */
+    template <std::size_t Count, std::size_t Size>
+    struct BlockPool
+    {
+        /** Acquire a block
+            @param size     The required size (if it's larger than a block, the allocation fails)
+            @return A pointer on the block or nullptr if none is available */
+        void * acquire(const std::size_t size)
+        {
+            if (size > Size) return nullptr;
+            for (std::size_t w = 0; w < Words; w++)
+            {
+                uint64 bits = used[w].load(std::memory_order_relaxed);
+                while (~bits)
+                {
+                    const std::size_t bit = (std::size_t)__builtin_ctzll(~bits);
+                    if (used[w].compare_exchange_weak(bits, bits | (1ULL << bit), std::memory_order_acquire, std::memory_order_relaxed))
+                        return blocks[w * 64 + bit];
+                }
+            }
+            return nullptr;
+        }
+        /** Release a block that was acquired from this pool */
+        void release(void * p)
+        {
+            const std::size_t index = (std::size_t)((uint8 (*)[BlockSize])p - blocks);
+            used[index / 64].fetch_and(~(1ULL << (index & 63)), std::memory_order_release);
+        }
+
+        BlockPool()
+        {
+            for (std::size_t w = 0; w < Words; w++) used[w].store(0, std::memory_order_relaxed);
+            // Mark the bits after the last block as used, so they are never returned
+            if (Count & 63) used[Words - 1].store(~0ULL << (Count & 63), std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr std::size_t Words = (Count + 63) / 64;
+        /** The blocks are aligned for any type */
+        static constexpr std::size_t BlockSize = (Size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+        alignas(std::max_align_t) uint8 blocks[Count][BlockSize];
+        std::atomic<uint64>             used[Words];
+    };
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef hpp_LRUList_hpp
+#define hpp_LRUList_hpp
+
+// We need types
+#include "Types.hpp"
+
+namespace Container
+{
+    /** A list of indexes ordered by their last use, for a fixed number of indexes.
+        It's a doubly linked list stored in an array (one node per index), so touching an index (moving it to the most recently used end),
+        removing it or finding the least recently used one are all O(1), without any allocation.
+        @param N    The number of indexes */
+    template <std::size_t N>
+    struct LRUList
+    {
+        typedef uint32 Index;
+        static constexpr Index      None = (Index)-1;
+
+        /** Mark the given index as the most recently used (it's added to the list if it wasn't in it) */
+        void touch(const Index index)
+        {
+            if (newest == index) return;
+            remove(index);
+            Node & node = nodes[index];
+            node.prev = newest;
+            node.next = None;
+            if (newest != None) nodes[newest].next = index;
+            else oldest = index;
+            newest = index;
+            ++count;
+        }
+        /** Remove the given index from the list (if it's in it) */
+        void remove(const Index index)
+        {
+            Node & node = nodes[index];
+            if (node.prev == Unlinked) return;
+            if (node.prev != None) nodes[node.prev].next = node.next;
+            else oldest = node.next;
+            if (node.next != None) nodes[node.next].prev = node.prev;
+            else newest = node.prev;
+            node.prev = node.next = Unlinked;
+            --count;
+        }
+        /** Check if the given index is in the list */
+        bool contains(const Index index) const { return nodes[index].prev != Unlinked; }
+        /** Get the least recently used index (or None if the list is empty) */
+        Index leastRecent() const { return oldest; }
+        /** Get the number of indexes in the list */
+        std::size_t getSize() const { return count; }
+
+        LRUList() { for (Index i = 0; i < N; i++) nodes[i].prev = nodes[i].next = Unlinked; }
+
+    private:
+        static constexpr Index      Unlinked = None - 1;
+        struct Node
+        {
+            Index   prev, next;
+        };
+        Node        nodes[N];
+        Index       oldest = None, newest = None;
+        std::size_t count = 0;
+    };
+}
+
+#endif
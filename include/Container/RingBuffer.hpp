@@ -358,8 +358,11 @@ namespace Container
         can be gradually reused to parse a huge input message down to a small abstract tree.
 
         Unlike the ring buffer, this doesn't wrap around if full.
-        Thus, data stored in the buffer is always contiguous. */
-    template <std::size_t sizePowerOf2>
+        Thus, data stored in the buffer is always contiguous.
+
+        If Attachable is true, the buffer isn't part of this object, but attached from an external pool when it's needed (and detached
+        when it's empty). While detached, the buffer has no space (and any attempt to store something fails). */
+    template <std::size_t sizePowerOf2, bool Attachable = false>
     struct TranscientVault
     {
         static constexpr std::size_t BufferSize = sizePowerOf2;
@@ -368,12 +371,20 @@ namespace Container
         /** Vault pointer in the buffer */
         uint32                          v;
         /** The buffer to write packets into */
-        uint8                           buffer[sizePowerOf2];
+        std::conditional_t<Attachable, uint8 *, uint8[sizePowerOf2]> buffer;
+
+        /** Check if a buffer is attached (always true if not Attachable) */
+        inline bool isAttached() const { if constexpr (Attachable) return buffer != nullptr; else return true; }
+        /** Attach the given buffer (of BufferSize bytes). The buffer is reset */
+        inline void attach(uint8 * b) requires Attachable { buffer = b; reset(); }
+        /** Detach the buffer
+            @return The previously attached buffer */
+        inline uint8 * detach() requires Attachable { uint8 * b = buffer; buffer = nullptr; w = v = 0; return b; }
 
         /** Get the consumed size in the transcient buffer */
         inline uint32 getSize() const { return w; }
         /** Get the size of the vault */
-        inline uint32 vaultSize() const { return sizePowerOf2 - v; }
+        inline uint32 vaultSize() const { return isAttached() ? sizePowerOf2 - v : 0; }
         /** Get the available size in the buffer */
         inline uint32 freeSize() const { return v - w; }
         /** Get the maximum size that can be stored in this buffer (without overwriting the vault) */
@@ -449,9 +460,9 @@ namespace Container
             return 0;
         }
         /** Reset the buffer */
-        void reset() { w = 0; v = sizePowerOf2;
+        void reset() { w = 0; v = isAttached() ? sizePowerOf2 : 0;
 #ifdef ParanoidServer
-            Zero(buffer);
+            if (isAttached()) memset(buffer, 0, sizePowerOf2);
 #endif
         }
         /** Persist data to the vault */
@@ -499,9 +510,10 @@ namespace Container
         }
 
         /** Build the ring buffer */
-        TranscientVault() : w(0), v(sizePowerOf2)
+        TranscientVault() : w(0), v(Attachable ? 0 : sizePowerOf2)
         {
             static_assert(sizePowerOf2 > 32, "A minimum size is required");
+            if constexpr (Attachable) buffer = nullptr;
         }
     };
 
@@ -0,0 +1,209 @@
+#ifndef hpp_TimerWheel_hpp
+#define hpp_TimerWheel_hpp
+
+// We need types
+#include "Types.hpp"
+
+namespace Container
+{
+    /** A hierarchical timer wheel, with a millisecond resolution, for a fixed number of timers identified by their index.
+        There's at most one pending deadline per index. Scheduling or cancelling a deadline is O(1), and advancing the time only
+        touches the expiring entries (and, once per wheel turn, the entries to move from an upper level to a lower level).
+        Each level has 64 slots (the first level covers 64ms, the second 4s, the third 4.5 minutes and the last 4.8 hours,
+        any deadline further away is clamped). A bitmap of the used slots per level allows to skip the empty slots.
+        The time is a 32 bits millisecond counter (that can wrap around).
+        @param N    The number of timers */
+    template <std::size_t N>
+    struct TimerWheel
+    {
+        typedef uint32 Index;
+        static constexpr Index      None = (Index)-1;
+        static constexpr uint32     Levels = 4, SlotBits = 6, Slots = 1 << SlotBits, SlotMask = Slots - 1;
+        static constexpr uint32     MaxDelay = (1U << (SlotBits * Levels)) - 1;
+
+        /** Start the wheel at the given time */
+        void init(const uint32 now)
+        {
+            base = now;
+            late = false;
+            for (Index i = 0; i < N; i++) { nodes[i].next = nodes[i].prev = None; nodes[i].slot = NotScheduled; }
+            for (uint32 l = 0; l < Levels; l++)
+            {
+                used[l] = 0;
+                for (uint32 s = 0; s < Slots; s++) heads[l][s] = None;
+            }
+        }
+
+        /** Schedule (or reschedule) the given timer's deadline */
+        void schedule(const Index index, uint32 deadline)
+        {
+            cancel(index);
+            if (isAfter(deadline, base + MaxDelay)) deadline = base + MaxDelay;
+            // The time was already processed (like a deadline for now, once the wheel is advanced to now)
+            if (isAfter(base, deadline)) late = true;
+            nodes[index].deadline = deadline;
+            insert(index);
+        }
+        /** Cancel the given timer (if scheduled) */
+        void cancel(const Index index)
+        {
+            Node & node = nodes[index];
+            if (node.slot == NotScheduled) return;
+            uint32 level = node.slot >> SlotBits, slot = node.slot & SlotMask;
+            if (node.prev != None) nodes[node.prev].next = node.next;
+            else heads[level][slot] = node.next;
+            if (node.next != None) nodes[node.next].prev = node.prev;
+            if (heads[level][slot] == None) used[level] &= ~(1ULL << slot);
+            node.next = node.prev = None;
+            node.slot = NotScheduled;
+        }
+        /** Check if the given timer is scheduled */
+        bool isScheduled(const Index index) const { return nodes[index].slot != NotScheduled; }
+
+        /** Advance the wheel's time up to now (included) and call the given function for each expired timer.
+            The function can schedule or cancel any timer */
+        template <typename Func>
+        void advance(const uint32 now, Func && expired)
+        {
+            if (late) expireLate(now, expired);
+            while (!isAfter(base, now))
+            {
+                uint32 slot = base & SlotMask;
+                // At the beginning of a turn, move the entries of the upper levels to the lower levels
+                if (!slot) cascade(1);
+                uint64 pending = used[0] >> slot;
+                if (!pending)
+                {   // Nothing in this turn, jump to the next one (or to now)
+                    uint32 nextTurn = (base | SlotMask) + 1;
+                    base = isAfter(nextTurn, now) ? now + 1 : nextTurn;
+                    continue;
+                }
+                uint32 next = base + (uint32)__builtin_ctzll(pending);
+                if (isAfter(next, now)) { base = now + 1; break; }
+                base = next;
+                // Expire all the timers in this slot (they can reschedule themselves, so detach the list first)
+                Index index = heads[0][base & SlotMask];
+                heads[0][base & SlotMask] = None;
+                used[0] &= ~(1ULL << (base & SlotMask));
+                base++;
+                while (index != None)
+                {
+                    Index following = nodes[index].next;
+                    nodes[index].next = nodes[index].prev = None;
+                    nodes[index].slot = NotScheduled;
+                    expired(index);
+                    index = following;
+                }
+            }
+        }
+
+        /** Get the time (in ms) until the wheel needs to be advanced again (either because a timer expires or because entries must
+            move down to a lower level, so it can be slightly earlier than the next deadline)
+            @param now      The current time
+            @param maxDelay The returned value if no timer is scheduled
+            @return The delay in ms, 0 if the wheel must be advanced now */
+        uint32 nextDelay(const uint32 now, const uint32 maxDelay) const
+        {
+            if (late) return 0;
+            bool found = false;
+            uint32 when = 0;
+            for (uint32 l = 0; l < Levels; l++)
+            {
+                if (!used[l]) continue;
+                const uint32 shift = l * SlotBits, current = (base >> shift) & SlotMask;
+                // The current slot of an upper level was already moved down (so it's for the next turn), unless the lower levels are
+                // at the beginning of their turn
+                const uint32 skip = l && (base & ((1U << shift) - 1)) ? 1 : 0, start = (current + skip) & SlotMask;
+                // Find the next used slot from there
+                const uint64 rotated = start ? (used[l] >> start) | (used[l] << (Slots - start)) : used[l];
+                const uint32 offset = (uint32)__builtin_ctzll(rotated) + skip;
+                const uint32 slotTime = l ? ((base >> shift) + offset) << shift : base + offset;
+                if (!found || isAfter(when, slotTime)) when = slotTime;
+                found = true;
+            }
+            if (!found) return maxDelay;
+            if (!isAfter(when, now)) return 0;
+            return when - now < maxDelay ? when - now : maxDelay;
+        }
+
+        TimerWheel() { init(0); }
+
+    private:
+        static constexpr uint16 NotScheduled = 0xFFFF;
+        struct Node
+        {
+            Index   next, prev;
+            uint32  deadline;
+            /** The level and slot of the node (level << SlotBits | slot) */
+            uint16  slot;
+        };
+        Node        nodes[N];
+        Index       heads[Levels][Slots];
+        uint64      used[Levels];
+        /** The next time to process */
+        uint32      base;
+        /** Set if a timer was scheduled for a time that's already processed */
+        bool        late;
+
+        /** Check if a is after b, with wrap around */
+        static bool isAfter(const uint32 a, const uint32 b) { return (int32)(a - b) > 0; }
+
+        /** Insert the node in the level and slot for its deadline */
+        void insert(const Index index)
+        {
+            Node & node = nodes[index];
+            uint32 delta = (int32)(node.deadline - base) < 0 ? 0 : node.deadline - base;
+            uint32 when = delta ? node.deadline : base;
+            uint32 level = 0;
+            while (level + 1 < Levels && delta >= (1U << (SlotBits * (level + 1)))) level++;
+            uint32 slot = (when >> (SlotBits * level)) & SlotMask;
+            node.slot = (uint16)(level << SlotBits | slot);
+            node.prev = None;
+            node.next = heads[level][slot];
+            if (node.next != None) nodes[node.next].prev = index;
+            heads[level][slot] = index;
+            used[level] |= 1ULL << slot;
+        }
+
+        /** Expire the timers scheduled for a time that's already processed. They are in the next slot to process (see insert), with
+            the timers due at that slot's time that stay there */
+        template <typename Func>
+        void expireLate(const uint32 now, Func && expired)
+        {
+            late = false;
+            const uint32 slot = base & SlotMask;
+            Index index = heads[0][slot];
+            heads[0][slot] = None;
+            used[0] &= ~(1ULL << slot);
+            while (index != None)
+            {
+                Index following = nodes[index].next;
+                nodes[index].next = nodes[index].prev = None;
+                nodes[index].slot = NotScheduled;
+                if (isAfter(nodes[index].deadline, now)) insert(index);
+                else expired(index);
+                index = following;
+            }
+        }
+
+        /** Move all the entries from the current slot of the given level to the lower levels */
+        void cascade(const uint32 level)
+        {
+            if (level >= Levels) return;
+            uint32 slot = (base >> (SlotBits * level)) & SlotMask;
+            // Start from the upper level if it's the beginning of its turn too
+            if (!slot) cascade(level + 1);
+            Index index = heads[level][slot];
+            heads[level][slot] = None;
+            used[level] &= ~(1ULL << slot);
+            while (index != None)
+            {
+                Index next = nodes[index].next;
+                insert(index);
+                index = next;
+            }
+        }
+    };
+}
+
+#endif
@@ -19,8 +19,8 @@ namespace Container
         Typical example is for a network "client" that need to persist its current state
         while it's receiving a request (and flushing its network's buffers).
         The client owns the ring buffer and release all of the temporary allocations at once in a single move */
-    template <std::size_t N>
-    static bool persistString(ROString & stringToPersist, Container::TranscientVault<N> & buffer, std::size_t futureDrop = 0)
+    template <std::size_t N, bool A>
+    static bool persistString(ROString & stringToPersist, Container::TranscientVault<N, A> & buffer, std::size_t futureDrop = 0)
     {
         const char * t = buffer.transferStringToVault(stringToPersist.getData(), stringToPersist.getLength(), futureDrop);
         if (!t) return false;
@@ -28,8 +28,8 @@ namespace Container
         stringToPersist.swapWith(tmp);
         return true;
     }
-    template <std::size_t N>
-    static bool persistStrings(MaxPersistStringArray & stringsToPersist, Container::TranscientVault<N> & buffer, std::size_t futureDrop = 0)
+    template <std::size_t N, bool A>
+    static bool persistStrings(MaxPersistStringArray & stringsToPersist, Container::TranscientVault<N, A> & buffer, std::size_t futureDrop = 0)
     {
         // Need to compute the total size required for the stack buffer
         std::size_t accLen = 0; std::size_t i = 0;
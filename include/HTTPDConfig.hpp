@@ -44,6 +44,232 @@
 #define MaxSupport            1
 
 
+/** Use epoll instead of select for monitoring the server's sockets (Linux only).
+    With select, the whole descriptor set is rebuilt and scanned on each loop and the descriptors are limited to FD_SETSIZE.
+    With epoll, the sockets are registered once and only the active sockets are processed in each loop, so it scales to
+    thousands of clients.
+
+    Default: 0 */
+#define UseEPoll              0
+
+/** Use non blocking sockets for the server's clients.
+    When a client can't accept the answer as fast as it's produced, the answer's stream is parked in the client's buffer and
+    the server continues serving the other clients. The answer resumes when the client's socket is writable again.
+    The request's content is received in the loop before calling the route's callback (if it fits in the client's buffer), so a larger
+    content must be fetched from an offloaded callback (see Offload in Route.hpp) or a coroutine route.
+    A CaptureAnswer's callback might be called after the route's callback returned, so it must own its state.
+    This is not supported with UseTLSServer.
+
+    Default: 0 */
+#define UseNonBlockingSocket  0
+
+/** The maximum number of bytes of a parked answer (like a FileAnswer) sent to a client each time the server loops, before serving the
+    other clients. A large download is then sent in slices, in turn with the other answers, so the small requests don't wait behind it.
+    0 for no limit (the answer is sent until the socket is full). It's scaled by the route's priority (see Prioritized in Route.hpp).
+    Only used if UseNonBlockingSocket is 1.
+
+    Default: 65536 */
+#define SendQuantum           65536
+
+/** Allow limiting the rate of the parked answers with token buckets (see Shaped in Route.hpp).
+    A shaped answer waits for its tokens without being monitored (so it doesn't sleep nor spin), and the other clients are served meanwhile.
+    A route can limit its answer's rate and share the global rate (GlobalSendRate) with the other shaped answers.
+    This requires UseNonBlockingSocket to be 1.
+
+    Default: 0 */
+#define UseEgressShaping      0
+
+/** The global rate (in bytes per second) shared by all the answers shaped with the global bucket. 0 for no limit.
+    It can be changed at runtime with Client::setGlobalSendRate.
+    Only used if UseEgressShaping is 1.
+
+    Default: 0 */
+#define GlobalSendRate        0
+
+/** The burst (in ms of the rate) a token bucket can accumulate. A larger burst is more tolerant to the loop's lag, but it lets more
+    data go at once after an idle time. It's also the largest delay between 2 slices of a shaped answer.
+    Only used if UseEgressShaping is 1.
+
+    Default: 50 */
+#define ShaperBurstMs         50
+
+/** Allow running some route's callback in a worker thread (see Offload in Route.hpp).
+    While an offloaded callback runs, the client's socket isn't monitored by the server, so the other clients are still
+    served even if the callback takes a long time (like receiving a firmware upload). Once the callback is done, the worker thread wakes
+    the server's loop up with an event descriptor (like UsePostedTasks) so the client is taken back right away.
+    This requires threads support.
+
+    Default: 0 */
+#define UseRouteOffloading    0
+
+/** The number of worker threads for the offloaded routes (each server has its own).
+    Only used if UseRouteOffloading is 1.
+
+    Default: 2 */
+#define OffloadWorkerCount    2
+
+/** Send the large in place answers (from their mapping, see Streams::Mappable) with MSG_ZEROCOPY (Linux only), so the system doesn't copy
+    them to the socket's buffers and the network card reads them from the answer's memory instead.
+    Only the parked answers are sent this way: such an answer isn't done until the system reports (in the socket's error queue) that it
+    doesn't use the memory anymore, usually once the client acknowledged the data, so the memory isn't changed or freed early (if it's not
+    reported within NonBlockingTimeout, the connection is aborted so the system drops the data). The server serves the other clients meanwhile.
+    So only the memory owned by the parked stream (like a Streams::MappedFileInput's mapping) or a static memory (Streams::StaticView) is
+    sent this way: a route can't know when the system is done with it. The client's buffer and borrowed views (Streams::MemoryView) are
+    always copied.
+    Over the loopback interface, the data is copied anyway (so the socket stops using MSG_ZEROCOPY after its first send).
+    This requires UseNonBlockingSocket to be 1.
+
+    Default: 0 */
+#define UseZeroCopySend       0
+
+/** The minimum size in bytes of a send done with MSG_ZEROCOPY, the smaller ones are copied (pinning the memory and reading the notifications
+    cost more than copying a small buffer). Only used if UseZeroCopySend is 1.
+
+    Default: 16384 */
+#define ZeroCopyThreshold     16384
+
+/** The size in bytes of a CaptureAnswer's pieces buffered before sending them as a chunk (see Streams::BufferedChunkedOutput).
+    The pieces are coalesced in the client's free buffer, so many small pieces (like a word at a time) are sent in a few large chunks, with
+    less system calls and less chunk's overhead on the wire. A smaller watermark sends the first pieces earlier.
+    0 to buffer as much as the client's free buffer can hold.
+
+    Default: 0 */
+#define ChunkWatermark        0
+
+/** Allow route's callbacks to be coroutines (returning a RouteTask, see Coroutine.hpp).
+    A coroutine can wait for more data (co_await client.recvMore()), for the socket to be writable (co_await client.writable())
+    or for some time (co_await sleepFor(ms)) and the server serves the other clients meanwhile.
+    The coroutine frames are allocated from a fixed pool, there's no heap allocation.
+
+    Default: 0 */
+#define UseCoroutineRoutes    0
+
+/** The number of coroutine frames in the pool, that is the maximum number of coroutine routes running at the same time.
+    Only used if UseCoroutineRoutes is 1.
+
+    Default: 8 */
+#define CoroutineFrameCount   8
+
+/** The maximum size of a coroutine's frame in bytes. This depends on the coroutine's local variables that live across a suspension
+    point. If a coroutine's frame is larger, the client is answered with a 503 error.
+    Only used if UseCoroutineRoutes is 1.
+
+    Default: 512 */
+#define CoroutineFrameSize    512
+
+/** The size kept free in a client's buffer while receiving a request's headers, so the route's headers can still be copied to the
+    vault for a coroutine or an offloaded route when the request's content follows its headers. It must be larger than a route's
+    headers.
+    Only used if UseCoroutineRoutes or UseRouteOffloading is 1.
+
+    Default: 256 */
+#define RouteHeadersReserve   256
+
+/** The listening socket's backlog, that is the number of connections the system keeps pending until the server accepts them.
+    The server uses the maximum of this and its maximum number of clients, so a burst of connections isn't refused while the
+    server is busy.
+
+    Default: 16 */
+#define ListenBacklog         16
+
+/** The maximum number of pending connections accepted each time the listening socket is ready.
+    Accepting many connections per loop reduces the connection setup latency during a burst, but delays the other clients.
+
+    Default: 8 */
+#define AcceptBatchSize       8
+
+/** The time in milliseconds a kept alive connection can stay idle before the server closes it.
+
+    Default: 5000 */
+#define KeepAliveTimeoutMs    5000
+
+/** The time in milliseconds a client has to send the request's headers, counted from the request's first byte
+    (or from the connection for the first request).
+
+    Default: 5000 */
+#define HeaderTimeoutMs       5000
+
+/** The time in milliseconds the server waits for more of the request's content before closing the connection.
+    This is counted from the last received data, so a slow but steady upload isn't aborted.
+
+    Default: 5000 */
+#define BodyTimeoutMs         5000
+
+/** Share the clients' receive buffers instead of embedding one buffer in each client.
+    A client only takes a buffer from a fixed pool (of SharedRecvBufferCount buffers of ClientBufferSize bytes) when it starts
+    receiving a request and gives it back once it's idle or closed, so an idle kept alive connection uses almost no memory.
+    If no buffer is available when a client sends a request, it's answered with a 503 error.
+
+    Default: 0 */
+#define UseSharedRecvBuffers  0
+
+/** The number of receive buffers in the shared pool, that is the maximum number of clients processing a request at the same time
+    (for all servers in the process). Only used if UseSharedRecvBuffers is 1.
+
+    Default: 16 */
+#define SharedRecvBufferCount 16
+
+/** Keep each client's receive buffer in an array of the server, apart from the clients, instead of embedding it in the client.
+    A client is then about 10 times smaller, so the loops scanning the clients (like finding a free slot for a new connection) only touch
+    a dense array instead of skipping a buffer for each client. Unlike UseSharedRecvBuffers, each client still has its own buffer.
+    This can't be used with UseSharedRecvBuffers.
+
+    Default: 0 */
+#define UseSeparateRecvBuffers 0
+
+/** Answer the connections the server can't serve now with a precomputed 503 error (with a Retry-After header) and close them, instead of
+    leaving them in the listening backlog until they time out. This doesn't use any client slot nor parse anything.
+    A connection is shed when no client slot is free (and more than ShedBacklogLength connections are pending) or when the loop is lagging.
+    Only the connections in the backlog can be shed, the system refuses the others, so ListenBacklog should be large enough for the expected bursts.
+
+    Default: 0 */
+#define UseOverloadShedding   0
+
+/** The delay in seconds sent in the Retry-After header of the 503 error. Only used if UseOverloadShedding is 1.
+
+    Default: 1 */
+#define ShedRetryAfterSec     1
+
+/** The time in milliseconds for processing a loop's events above which the server is considered lagging, so all the new connections are shed.
+    0 to disable. Only used if UseOverloadShedding is 1.
+
+    Default: 100 */
+#define ShedLoopLagMs         100
+
+/** The number of pending connections left in the backlog (waiting for a client slot to be freed) when all the slots are used.
+    The excess is shed. This is only known for TCP on Linux (elsewhere, all the pending connections are shed if there's no free slot).
+    Only used if UseOverloadShedding is 1.
+
+    Default: 0 */
+#define ShedBacklogLength     0
+
+/** Close the least recently active idle kept alive connection when a new connection arrives while all the client slots are used,
+    so its slot is given to the new connection instead of leaving it in the backlog. A connection is idle when it waits for its next
+    request and has nothing saved in its buffer. The idle clients are tracked in a list ordered by their last activity (O(1) per update).
+
+    Default: 0 */
+#define UseIdleEviction       0
+
+/** Allow other threads to post tasks to a server (with its post method). The tasks are run by the server's thread at the beginning of
+    its next loop, and an event descriptor (eventfd on Linux) wakes the loop up as soon as a task is posted.
+    A task can then safely use the clients (like completing a deferred answer or closing a client).
+
+    Default: 0 */
+#define UsePostedTasks        0
+
+/** The maximum number of tasks posted to a server and not run yet (a power of 2). Only used if UsePostedTasks is 1.
+
+    Default: 64 */
+#define PostedTaskCount       64
+
+/** Count the server's activity (accepted connections, routed requests, timed out clients, see ServerStats in Route.hpp).
+    The counters are only written by the server's thread but they can be read from anywhere, even from another process when they are
+    in shared memory (this is required for PreforkServer).
+
+    Default: 0 */
+#define UseServerStats        0
+
+
 #if UseTLSServer == 1 || UseTLSClient == 1
   #define UseTLS 1
 #else
@@ -53,6 +53,8 @@ namespace Network::Common::HTTP
             for(; pos < headerArray.size(); ++pos) if (headerArray[pos] == h) break;
             return pos;
         }
+        /** Check if the given header is in this array (at compile time) */
+        static constexpr bool hasHeader(const Headers h) { return findHeaderPos(h) < headerArray.size(); }
         // Compile time version, faster O(1) at runtime, and smaller, obviously
         template <Headers h>
         RequestHeader<h> & getHeader()
@@ -140,8 +142,8 @@ namespace Network::Common::HTTP
         template <typename T>
         bool loadHeaderFromBuffer(T & t, uint8 *& buf, std::size_t & size) { void * b = 0; return serializeHeaderToBuffer(t, buf, size, b, false); }
 
-        template <std::size_t N>
-        bool saveInVault(Container::TranscientVault<N> & buffer)
+        template <std::size_t N, bool A>
+        bool saveInVault(Container::TranscientVault<N, A> & buffer)
         {
             std::size_t size = getRequiredVaultSize();
             // Save the buffer to the stack before being erased (in reverse order)
@@ -156,8 +158,8 @@ namespace Network::Common::HTTP
             return false;
         }
 
-        template <std::size_t N>
-        bool loadFromVault(Container::TranscientVault<N> & buffer)
+        template <std::size_t N, bool A>
+        bool loadFromVault(Container::TranscientVault<N, A> & buffer)
         {
             std::size_t size = buffer.vaultSize();
             // Save the buffer to the stack before being erased (in reverse order)
@@ -0,0 +1,145 @@
+#ifndef hpp_IOURing_hpp
+#define hpp_IOURing_hpp
+
+// We need our configuration
+#include "HTTPDConfig.hpp"
+
+// We need basic errors
+#include "InternalErrors.hpp"
+
+// We need the kernel's io_uring interface (we don't depend on liburing here)
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace Network
+{
+    /** A minimal io_uring instance.
+        This only maps the submission and completion rings and offers a way to fill submission entries and to consume the completions.
+        There's no allocation here, except for the rings that are allocated by the kernel upon init() */
+    struct IOURing
+    {
+        /** The ring descriptor */
+        int             fd = -1;
+
+        /** Initialize the rings
+            @param entries  The number of submission entries (the completion ring is twice as large)
+            @return Success or AllocationFailure if the kernel refused to create the rings */
+        Error init(const uint32 entries)
+        {
+            io_uring_params params = {};
+            fd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0) return AllocationFailure;
+
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+            sqRing = ::mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED) { sqRing = 0; return AllocationFailure; }
+            cqRing = single ? sqRing : ::mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED) { cqRing = 0; return AllocationFailure; }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe*)::mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) { sqes = 0; return AllocationFailure; }
+
+            uint8 * sq = (uint8*)sqRing, * cq = (uint8*)cqRing;
+            sqHead = (uint32*)(sq + params.sq_off.head);
+            sqTail = (uint32*)(sq + params.sq_off.tail);
+            sqMask = *(uint32*)(sq + params.sq_off.ring_mask);
+            sqArray = (uint32*)(sq + params.sq_off.array);
+            sqEntries = params.sq_entries;
+            cqHead = (uint32*)(cq + params.cq_off.head);
+            cqTail = (uint32*)(cq + params.cq_off.tail);
+            cqMask = *(uint32*)(cq + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+            localTail = submitted = *sqTail;
+            return Success;
+        }
+
+        /** Get a new submission entry to fill. It's submitted on the next call to submitAndWait
+            @return A pointer to a zeroed entry or 0 if the submission ring is full and can't be submitted */
+        io_uring_sqe * getEntry()
+        {
+            if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            {   // Ring is full, so submit what we have to make space
+                if (submitAndWait(0, 0).isError()) return 0;
+                if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return 0;
+            }
+            uint32 index = localTail & sqMask;
+            io_uring_sqe * sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqArray[index] = index;
+            ++localTail;
+            return sqe;
+        }
+
+        /** Submit all the pending entries and wait for some completions (in a single system call)
+            @param waitCount    The minimum number of completion to wait for (0 to only submit)
+            @param timeoutMs    The maximum time to wait for the completions
+            @return Success, Timeout if no completion happened in time or Select upon error */
+        Error submitAndWait(const uint32 waitCount, const uint32 timeoutMs)
+        {
+            __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+            uint32 toSubmit = localTail - submitted;
+
+            __kernel_timespec ts = { (long long)(timeoutMs / 1000), (long long)(timeoutMs % 1000) * 1000000 };
+            io_uring_getevents_arg arg = {};
+            arg.ts = (uint64)(uintptr_t)&ts;
+            int ret = (int)::syscall(__NR_io_uring_enter, fd, toSubmit, waitCount, waitCount ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0, waitCount ? &arg : nullptr, sizeof(arg));
+            if (ret < 0) return errno == ETIME || errno == EINTR ? Timeout : Select;
+            submitted += (uint32)ret;
+            return Success;
+        }
+
+        /** Check if any completion is available (without any system call) */
+        bool hasCompletion() const { return *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); }
+
+        /** Consume all the available completions
+            @param f    A callable with a (const io_uring_cqe &) signature, called for each completion
+            @return The number of completions processed */
+        template <typename Func>
+        uint32 forEachCompletion(Func && f)
+        {
+            uint32 head = *cqHead, tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE), count = 0;
+            while (head != tail)
+            {
+                // Copy the completion, the callback might submit more entries
+                io_uring_cqe cqe = cqes[head & cqMask];
+                __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+                f(cqe);
+                ++count;
+                if (head == tail) tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            }
+            return count;
+        }
+
+        IOURing() {}
+        ~IOURing()
+        {
+            if (sqes) ::munmap(sqes, sqesSize);
+            if (cqRing && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+            if (sqRing) ::munmap(sqRing, sqRingSize);
+            if (fd != -1) ::close(fd);
+        }
+
+    private:
+        void *          sqRing = 0, * cqRing = 0;
+        std::size_t     sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+        uint32 *        sqHead = 0, * sqTail = 0, * sqArray = 0;
+        uint32          sqMask = 0, sqEntries = 0;
+        io_uring_sqe *  sqes = 0;
+        uint32 *        cqHead = 0, * cqTail = 0;
+        uint32          cqMask = 0;
+        io_uring_cqe *  cqes = 0;
+        /** The tail we've filled and the number of entries we've submitted to the kernel */
+        uint32          localTail = 0, submitted = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef hpp_Coroutine_hpp
+#define hpp_Coroutine_hpp
+
+// We need Client declaration
+#include "HTTP.hpp"
+// We need the fixed pool for the coroutine frames
+#include "Container/BlockPool.hpp"
+
+#if UseCoroutineRoutes != 1
+  #error "Coroutine routes require UseCoroutineRoutes to be set to 1"
+#endif
+
+namespace Network::Servers::HTTP
+{
+    /** The return type of a route's callback that's a coroutine.
+        Such a callback has the same arguments as a usual route's callback and co_return a boolean instead of returning it.
+        While it waits (with co_await client.recvMore(), co_await client.writable() or co_await sleepFor(ms)), the server serves
+        the other clients, and it resumes the coroutine when the awaited event happens.
+        The coroutine frames are allocated from a fixed pool of CoroutineFrameCount blocks of CoroutineFrameSize bytes.
+        If none is available (or the frame is too large), the client is answered with a 503 error.
+        Usage:
+        @code
+            auto Upload = [](Client & client, const auto & headers) -> RouteTask
+            {
+                std::size_t left = headers.template getHeader<Headers::ContentLength>().getValueElement(0);
+                while (left)
+                {
+                    std::size_t size = client.recvBuffer.getSize();
+                    if (!size && !(size = co_await client.recvMore())) co_return false;
+                    // Use the data in client.recvBuffer here...
+                    left -= min(size, left);
+                    client.recvBuffer.resetTranscient(0);
+                }
+                co_return client.reply(Code::Ok);
+            };
+        @endcode
+        The headers are copied to the client's vault before the coroutine starts, they aren't valid anymore once the answer is sent. */
+    struct RouteTask
+    {
+        struct promise_type
+        {
+            /** The client the coroutine is running for */
+            Client & client;
+
+            /** Find the client in the coroutine's arguments (the first one is the lambda's object for a lambda) */
+            template <typename ... Args>
+            promise_type(Args & ... args) : client(findClient(args...)) {}
+
+            RouteTask get_return_object() { return RouteTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+            static RouteTask get_return_object_on_allocation_failure() { return RouteTask{}; }
+            // Run the coroutine directly, up to its first suspension point
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            // Keep the frame once done, the client destroys it
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_value(bool result) { client.routeResult = result; }
+            void unhandled_exception() { client.routeResult = false; }
+
+            // Not inlined, else the compiler wrongly warns about deleting a static object (the pool)
+            [[gnu::noinline]] static void * operator new(std::size_t size) noexcept { return getFramePool().acquire(size); }
+            static void operator delete(void * frame) { getFramePool().release(frame); }
+
+        private:
+            typedef Container::BlockPool<CoroutineFrameCount, CoroutineFrameSize> FramePool;
+            static FramePool & getFramePool() { static FramePool pool; return pool; }
+
+            template <typename T, typename ... Args>
+            static Client & findClient(T & arg, Args & ... args)
+            {
+                if constexpr (std::is_same_v<std::decay_t<T>, Client>) return arg;
+                else return findClient(args...);
+            }
+        };
+
+        /** The coroutine's handle (it's empty if the frame couldn't be allocated) */
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    /** Wait for the given time (in ms) in a route's coroutine. The client's socket isn't monitored meanwhile */
+    inline auto sleepFor(const uint32 delayMs)
+    {
+        struct Awaiter
+        {
+            uint32 delayMs;
+            bool await_ready() const { return false; }
+            void await_suspend(std::coroutine_handle<RouteTask::promise_type> coroutine)
+            {
+                Client & client = coroutine.promise().client;
+                client.wakeUpDelay = delayMs;
+                client.awaiting = Client::AwaitingTimer;
+            }
+            void await_resume() const {}
+        };
+        return Awaiter{delayMs};
+    }
+
+    /** Start a route's callback that's a coroutine */
+    template <auto Callback, typename H>
+    static ClientState startCoroutine(Client & client, const H & headers)
+    {
+        static_assert(std::is_copy_constructible_v<H>, "The route's headers must be copyable for a coroutine");
+        // The coroutine outlives the route's parsing, so copy the headers in the vault
+        uint8 * p = client.recvBuffer.reserveInVault(sizeof(H) + alignof(H) - 1);
+        if (!p) { client.closeWithError(Code::InternalServerError); return ClientState::Error; }
+        p = (uint8*)(((uintptr_t)p + alignof(H) - 1) & ~(uintptr_t)(alignof(H) - 1));
+        H * copy = new (p) H(headers);
+
+        RouteTask task = Callback(client, *copy);
+        if (!task.handle)
+        {
+            SLog(Level::Warning, "Client %s: no coroutine frame available", client.socket.address);
+            copy->~H();
+            client.closeWithError(Code::Unavailable);
+            return ClientState::Error;
+        }
+        return client.startRoute(task.handle, [](void * arg) { ((H*)arg)->~H(); }, copy);
+    }
+}
+
+#endif
@@ -19,6 +19,35 @@
 #include "Forms.hpp"
 
 #include <type_traits>
+#if UseNonBlockingSocket == 1 || UseRouteOffloading == 1
+// We need placement new for parking streams or offloaded headers
+#include <new>
+#endif
+#if UseRouteOffloading == 1
+// We need the offloading state shared with the worker threads
+#include <atomic>
+#endif
+#if UseCoroutineRoutes == 1
+// We need coroutine handles for the routes that are coroutines
+#include <coroutine>
+#endif
+#if UseSharedRecvBuffers == 1
+  #if UseSeparateRecvBuffers == 1
+    #error "The receive buffers can either be shared or separate, not both"
+  #endif
+// We need the fixed pool for the shared receive buffers
+#include "Container/BlockPool.hpp"
+#endif
+#if UseZeroCopySend == 1 && UseNonBlockingSocket != 1
+  #error "Zero copy sending requires UseNonBlockingSocket to be set to 1"
+#endif
+#if UseEgressShaping == 1
+  #if UseNonBlockingSocket != 1
+    #error "Egress shaping requires UseNonBlockingSocket to be set to 1"
+  #endif
+// We need token buckets for shaping the answers
+#include "Network/TokenBucket.hpp"
+#endif
 
 
 #ifndef ClientBufferSize
@@ -30,6 +59,13 @@ namespace Network::Servers::HTTP
     using namespace Protocol::HTTP;
     using namespace Network::Common::HTTP;
 
+#ifndef SLog
+    // If no log function defined, let's define a no-op stub here
+    template <typename ... Args>
+    constexpr void noLog(Network::Level, const char*, Args && ...) {}
+    #define SLog noLog
+#endif
+
 #if UseTLSServer == 1
     typedef MBTLSSocket Socket;
 #else
@@ -41,6 +77,12 @@ namespace Network::Servers::HTTP
     static constexpr const char EntityTooLargeAnswer[] = "HTTP/1.1 413 Entity too large\r\n\r\n";
     static constexpr const char InternalServerErrorAnswer[] = "HTTP/1.1 500 Internal server error\r\n\r\n";
     static constexpr const char NotFoundAnswer[] = "HTTP/1.1 404 Not found\r\n\r\n";
+    static constexpr const char UnavailableAnswer[] = "HTTP/1.1 503 Service unavailable\r\nConnection:close\r\n\r\n";
+#if UseOverloadShedding == 1
+    #define STRINGIFY(A) #A
+    #define STRINGIFY_DEFERRED(A) STRINGIFY(A)
+    static constexpr const char OverloadedAnswer[] = "HTTP/1.1 503 Service unavailable\r\nRetry-After:" STRINGIFY_DEFERRED(ShedRetryAfterSec) "\r\nContent-Length:0\r\nConnection:close\r\n\r\n";
+#endif
     static constexpr const char ChunkedEncoding[] = "Transfer-Encoding:chunked\r\n\r\n";
     static constexpr const char ConnectionClose[] = "Connection:close\r\n";
 
@@ -51,6 +93,20 @@ namespace Network::Servers::HTTP
         Processing  = 1,
         NeedRefill  = 2,
         Done        = 3,
+#if UseRouteOffloading == 1
+        Offloaded   = 4,    //!< The route's callback will run in a worker thread, the server must not touch the client until it's done
+#endif
+#if UseCoroutineRoutes == 1
+        Suspended   = 5,    //!< The route's coroutine is waiting (see Client::AwaitState), the server resumes it when it's possible
+#endif
+    };
+
+    /** The priority of a route's answer, when it's sent in slices (see SendQuantum) */
+    enum class SendPriority : uint8
+    {
+        Background  = 0,    //!< A quarter of SendQuantum is sent each time (for large downloads)
+        Normal      = 1,    //!< SendQuantum is sent each time
+        Interactive = 2,    //!< Four times SendQuantum is sent each time
     };
 
     /** A client which is linked with a single session.
@@ -66,7 +122,7 @@ namespace Network::Servers::HTTP
             [ Invalid ] ==> Request line incomplete => [ ReqLine ]
             [ ReqLine ] ==> Request line complete => [ RecvHeaders ]
             [ RecvHeader ] ==> \r\n\r\n found ? => [ HeadersDone ] (else [NeedRefillHeaders], currently not implemented)
-            [ HeadersDone ] ==> Content received? => [ ReqDone ]
+            [ HeadersDone ] ==> Content received? => [ ReqDone ] (else [ RecvContent ], with non blocking sockets, see awaitContent)
             @endcode */
         enum ParsingStatus
         {
@@ -75,33 +131,44 @@ namespace Network::Servers::HTTP
             RecvHeaders,
             NeedRefillHeaders, // Currently not implemented, used to trigger route's processing for emptying the recv buffer in case the request doesn't fill the available buffer
             HeadersDone,
+            RecvContent, // The route's headers are saved in the vault while the request's content is received
             ReqDone,
 
         } parsingStatus;
 
-        /** The buffer where all the per-request data is saved */
-        Container::TranscientVault<ClientBufferSize> recvBuffer;
+        /** The buffer where all the per-request data is saved (it's taken from a shared pool if UseSharedRecvBuffers is 1, or it's the
+            server's one for this client if UseSeparateRecvBuffers is 1) */
+        Container::TranscientVault<ClientBufferSize, UseSharedRecvBuffers == 1 || UseSeparateRecvBuffers == 1> recvBuffer;
         /** The current request as received and parsed by the server */
         RequestLine reqLine;
-        /** Whether to close or keep the connection open after this request.
-            When a connection is kept open, each loop without activity will decrease the TTL until it reaches 0 and force the client connection to close */
+        /** Whether to close (0) or keep the connection open after this request.
+            The server closes an idle connection after KeepAliveTimeoutMs */
         uint8       timeToLive = 0;
 
         /** The content length for the answer */
         std::size_t answerLength;
         Code        replyCode;
+        /** The priority of the current answer (see Prioritized) */
+        SendPriority sendPriority = SendPriority::Normal;
 
         /** Send the client answer as expected */
         template <typename T>
         bool sendAnswer(T && clientAnswer) {
-            if (!sendStatus(clientAnswer.getCode())) return false;
-
             // We'll be loosing the URI content when we clear the recvBuffer for sending data back, so store the
             // request URI on the stack for logging purpose below
             char * URI = (char*)alloca(reqLine.URI.absolutePath.getLength());
             memcpy(URI, reqLine.URI.absolutePath.getData(), reqLine.URI.absolutePath.getLength());
 
+#if UseNonBlockingSocket == 1
+            // Keep the vault here, the request line is used for logging if the answer is resumed later on
+            recvBuffer.resetTranscient();
+#else
             recvBuffer.reset();
+#endif
+            // Gather the answer's head (and the content's beginning) in the free buffer, so a small answer is sent with a single system call
+            Cork cork(socket, (char*)recvBuffer.getTail(), recvBuffer.freeSize());
+            if (!sendStatus(clientAnswer.getCode())) return false;
+
             // Force closing the connection if required or asked, we don't send the Connection:keep-alive header since it's the default in HTTP/1.1
             if (!timeToLive)
                 socket.send(ConnectionClose, sizeof(ConnectionClose) - 1);
@@ -121,13 +188,34 @@ namespace Network::Servers::HTTP
                     }
 
                     // Send the content now
+#if UseNonBlockingSocket == 1
+                    if (reqLine.method != Method::HEAD)
+                    {
+                        if (!sendStream(stream)) return false;
+                        if (isSending())
+                        {   // The answer will continue when the socket is writable again
+                            this->answerLength = answerLength;
+                            replyCode = clientAnswer.getCode();
+                            return true;
+                        }
+                    }
+#else
+                    if constexpr (Streams::InPlace<std::decay_t<decltype(stream)>>)
+                    {   // Any remaining content (if the system refused it) is read and sent below
+                        if (reqLine.method != Method::HEAD && canSendInPlace(stream))
+                            while (stream.getPos() < answerLength)
+                                if (Error ret = sendInPlace(stream, answerLength - stream.getPos(), true); ret.isError() || !ret.getCount()) break;
+                    }
                     while (reqLine.method != Method::HEAD)
                     {
-                        std::size_t p = stream.read(recvBuffer.getTail(), recvBuffer.freeSize());
+                        // Read after the gathered data, so the content's beginning is sent along with the head
+                        const uint32 gathered = socket.gatheredSize();
+                        std::size_t p = stream.read(recvBuffer.getTail() + gathered, recvBuffer.freeSize() - gathered);
                         if (!p) break;
 
-                        socket.send((const char*)recvBuffer.getTail(), p);
+                        socket.send((const char*)recvBuffer.getTail() + gathered, p);
                     }
+#endif
 
                 } else if (stream.hasContent() && reqLine.method != Method::HEAD)
                 {
@@ -135,12 +223,19 @@ namespace Network::Servers::HTTP
                         // Need to send a transfer encoding header if we don't have a size for the content and it's not done by the client's answer by itself
                         socket.send(ChunkedEncoding, sizeof(ChunkedEncoding) - 1);
                     }
-
+                    // The socket is still corked, so the content's beginning can be sent with the head (the answer uncorks it if it uses the buffer)
                     if (!clientAnswer.sendContent(*this, answerLength))
                     {
                         SLog(Level::Info, "Client %s [%.*s](%u): %d%s", socket.address, (int)reqLine.URI.absolutePath.getLength(), URI, 0U, 524, !timeToLive ? " closed" : "");
                         return false;
                     }
+#if UseNonBlockingSocket == 1
+                    if (isSending())
+                    {   // The chunks are counted in answerLength while they are sent
+                        replyCode = clientAnswer.getCode();
+                        return true;
+                    }
+#endif
                 } else if (!stream.hasContent())
                 {
                     if (!sendSize(0))
@@ -158,14 +253,545 @@ namespace Network::Servers::HTTP
                 }
             }
 
+#if UseNonBlockingSocket == 1
+            // Send the gathered answer without waiting for the socket, what it doesn't accept is sent once it's writable again
+            if (!sendPending()) return false;
+            if (isSending())
+            {
+                this->answerLength = answerLength;
+                replyCode = clientAnswer.getCode();
+                return true;
+            }
+#else
+            socket.uncork();
+#endif
             SLog(Level::Info, "Client %s [%.*s](%u): %d%s", socket.address, (int)reqLine.URI.absolutePath.getLength(), URI, answerLength, (int)clientAnswer.getCode(), !timeToLive ? " closed" : "");
             parsingStatus = ReqDone;
             reset();
             return true;
         }
 
+        /** Check if the stream's content can be sent in place instead of being read in the buffer, that is from its mapping (see
+            Streams::Mappable) or directly from its file with sendfile (see Streams::DescriptorBacked, only for a regular file and a non TLS socket) */
+        template <Streams::InPlace Stream>
+        bool canSendInPlace(Stream & stream)
+        {
+            if constexpr (Streams::Mappable<Stream>)
+            {
+                void * data = stream.map();
+                stream.unmap(data);
+                return data != nullptr;
+            }
+#if defined(__linux__)
+            else if constexpr (Streams::DescriptorBacked<Stream>) return stream.isRegular() && !socket.getType();
+#endif
+            else return false;
+        }
+
+        /** Send up to the given length of the stream's content in place (see canSendInPlace), with a single large send.
+            The stream's position is updated with what is sent
+            @param wait     If true, wait for the socket to accept it all, else only send what the socket accepts now
+            @return the number of bytes sent (less than the length for a huge length or if the socket is full) or an error */
+        template <Streams::InPlace Stream>
+        Error sendInPlace(Stream & stream, std::size_t length, [[maybe_unused]] const bool wait)
+        {
+            // Keep the count in an Error
+            length = min(length, (std::size_t)1 << 30);
+            const std::size_t pos = stream.getPos();
+            if constexpr (Streams::Mappable<Stream>)
+            {
+                const char * data = (const char*)stream.map();
+                Error ret = Success;
+#if UseZeroCopySend == 1
+                // Only a parked answer is sent without copying, since it's only done once the system doesn't use its memory anymore. Its
+                // memory must stay valid until then, so it's owned by the parked stream (like a mapped file) or static (see Streams::StaticView):
+                // a borrowed view is released when the route returns. The client's buffer is reused for the next request, so it's always copied
+                if (!Streams::Borrowed<Stream> && !wait && length >= ZeroCopyThreshold && socket.canZeroCopy() && !recvBuffer.contains(data + pos))
+                    ret = socket.sendZeroCopy(data + pos, (uint32)length);
+                else
+#endif
+#if UseNonBlockingSocket == 1
+                ret = wait ? socket.send(data + pos, (uint32)length) : socket.trySend(data + pos, (uint32)length);
+#else
+                ret = socket.send(data + pos, (uint32)length);
+#endif
+                stream.unmap((void*)data);
+                if (!ret.isError()) stream.setPos(pos + (std::size_t)ret.getCount());
+                return ret;
+            }
+#if defined(__linux__)
+            else if constexpr (Streams::DescriptorBacked<Stream>)
+            {
+                off_t offset = (off_t)pos;
+  #if UseNonBlockingSocket == 1
+                Error ret = wait ? socket.sendFile(stream.getDescriptor(), offset, length) : socket.trySendFile(stream.getDescriptor(), offset, length);
+  #else
+                Error ret = socket.sendFile(stream.getDescriptor(), offset, length);
+  #endif
+                // The offset tells what's sent, even upon error
+                stream.setPos((std::size_t)offset);
+                return ret.isError() && offset == (off_t)pos ? ret : Error((int)(offset - (off_t)pos));
+            }
+#endif
+            else return Sending;
+        }
+
+#if UseNonBlockingSocket == 1
+        /** The pending output in the transcient buffer, when the socket couldn't accept the whole answer */
+        uint32      outPos = 0, outEnd = 0;
+        /** The answer's stream, parked in the vault while waiting for the socket to be writable */
+        void *      parkedStream = nullptr;
+        /** The function used to resume (or abort) sending the parked stream */
+        bool        (*resumeFunc)(Client &, bool abort) = nullptr;
+
+        /** Check if this client is still sending an answer */
+        bool isSending() const { return resumeFunc != nullptr; }
+        /** The number of bytes of the parked answer sent before serving the other clients (0 for no limit) */
+        std::size_t sendQuantum() const { return (std::size_t)SendQuantum << (2 * (uint8)sendPriority) >> 2; }
+#if UseEgressShaping == 1
+        /** The answer's own rate limit */
+        Network::TokenBucket shaper;
+        /** The time to wait (in ms) for the shapers' tokens before sending more of the parked answer (0 if not throttled) */
+        uint16      throttleDelay = 0;
+        /** Whether the answer also takes its tokens from the global bucket */
+        bool        globalShaping = false;
+
+        /** Limit the current answer's rate (in bytes per second, 0 for no limit), and make it share the global rate if global is true (see Shaped) */
+        void shapeAnswer(const uint32 bytesPerSecond, const bool global)
+        {
+            shaper.setRate(bytesPerSecond, getMonotonicTimeMs());
+            globalShaping = global;
+        }
+        /** Check if the answer is waiting for the shapers' tokens */
+        bool isThrottled() const { return throttleDelay != 0; }
+        /** Change the global rate (in bytes per second, 0 for no limit) shared by the answers shaped with the global bucket */
+        static void setGlobalSendRate(const uint32 bytesPerSecond)
+        {
+            const uint32 now = getMonotonicTimeMs();
+            globalShaper().locked([&](Network::TokenBucket & bucket) { bucket.setRate(bytesPerSecond, now); return true; });
+        }
+    private:
+        static Network::SharedTokenBucket & globalShaper() { static Network::SharedTokenBucket bucket(GlobalSendRate, getMonotonicTimeMs()); return bucket; }
+        /** Take the tokens for sending up to the given size. A whole slice (the size or a burst) is waited for, instead of sending
+            tiny packets as soon as a few tokens are available.
+            @return the size that can be sent now, or 0 (and throttleDelay is set) if the tokens aren't available yet */
+        std::size_t takeTokens(std::size_t size)
+        {
+            throttleDelay = 0;
+            if (!shaper.rate && !globalShaping) return size;
+            const uint32 now = getMonotonicTimeMs();
+            if (shaper.rate) size = min(size, shaper.burstSize());
+            // Both buckets must have the tokens before any is taken
+            auto wait = [&](Network::TokenBucket * global)
+            {
+                if (global && global->rate) size = min(size, global->burstSize());
+                uint32 delay = shaper.delayFor(size, now), globalDelay = global ? global->delayFor(size, now) : 0;
+                if (delay < globalDelay) delay = globalDelay;
+                if (delay) return delay;
+                shaper.take(size);
+                if (global) global->take(size);
+                return delay;
+            };
+            uint32 delay = globalShaping ? globalShaper().locked([&](Network::TokenBucket & bucket) { return wait(&bucket); }) : wait(nullptr);
+            if (!delay) return size;
+            throttleDelay = (uint16)min(delay, (uint32)ShaperBurstMs);
+            return 0;
+        }
+        /** Give back the tokens that weren't used (when the answer ended) */
+        void giveBackTokens(const std::size_t size)
+        {
+            if (!size) return;
+            shaper.giveBack(size);
+            if (globalShaping) globalShaper().locked([&](Network::TokenBucket & bucket) { bucket.giveBack(size); return true; });
+        }
+    public:
+#endif
+        /** Continue sending the pending answer. This is called by the server when the socket is writable again
+            @return false upon error (the client should be closed then) */
+        bool resumeSending()
+        {
+            if (!resumeFunc || !resumeFunc(*this, false)) return false;
+            if (isSending()) return true;
+
+            SLog(Level::Info, "Client %s [%.*s](%u): %d%s", socket.address, (int)reqLine.URI.absolutePath.getLength(), reqLine.URI.absolutePath.getData(), answerLength, (int)replyCode, !timeToLive ? " closed" : "");
+            parsingStatus = ReqDone;
+            reset();
+            return true;
+        }
+
+        /** Send the given stream (after the gathered head) without waiting for the socket.
+            If the socket can't accept the whole answer, the stream is moved to the vault and sending continues in resumeSending().
+            A borrowed stream (see Streams::Borrowed) isn't moved, its content is copied instead (see sendBorrowed)
+            @return false upon error */
+        template <typename Stream>
+        bool sendStream(Stream & stream)
+        {
+            // The gathered head stays at the buffer's beginning, it's sent first
+            outPos = 0;
+            outEnd = socket.stopGathering();
+            if constexpr (Streams::Borrowed<Stream>) return sendBorrowed(stream);
+            else
+            {
+                if constexpr (std::is_move_constructible_v<Stream>)
+                {
+                    // Reserve the space for the stream in the vault (after the head), the transcient buffer is then used for reading the stream
+                    recvBuffer.stored(outEnd);
+                    uint8 * p = recvBuffer.reserveInVault(sizeof(Stream) + alignof(Stream) - 1);
+                    recvBuffer.resetTranscient();
+                    if (p)
+                    {
+                        p = (uint8*)(((uintptr_t)p + alignof(Stream) - 1) & ~(uintptr_t)(alignof(Stream) - 1));
+                        parkedStream = new (p) Stream(std::move(stream));
+                        resumeFunc = &Client::resumeStream<Stream>;
+                        // Read the content's beginning right after the head, so a short answer is sent with a single system call
+                        bool inPlace = false;
+                        if constexpr (Streams::InPlace<Stream>) inPlace = canSendInPlace(*(Stream*)parkedStream);
+                        if (!inPlace) readMore(*(Stream*)parkedStream);
+                        return resumeFunc(*this, false);
+                    }
+                }
+                // Sending the stream while waiting for the socket would stall the other clients, so answer with an error instead
+                SLog(Level::Warning, "Client %s: can't park the answer's stream (%u bytes) in the vault", socket.address, (unsigned)sizeof(Stream));
+                outEnd = 0;
+                closeWithError(Code::InternalServerError);
+                return false;
+            }
+        }
+
+        /** Send a borrowed stream (after the pending head) without waiting for the socket. Its memory might be released once the route
+            returns, so what the socket doesn't accept now is copied in the buffer and sent in resumeSending(). A content larger than
+            the buffer is sent in place first, and the connection is closed if the socket doesn't accept enough of it
+            @return false upon error */
+        template <typename Stream>
+        bool sendBorrowed(Stream & stream)
+        {
+            std::size_t left = stream.getSize() - stream.getPos();
+            if (left > recvBuffer.maxSize() - outEnd)
+            {
+                Error ret = socket.trySend((const char*)recvBuffer.getHead(), outEnd);
+                if (!ret.isError()) outPos = (uint32)ret.getCount();
+                if (!ret.isError() && outPos == outEnd && canSendInPlace(stream))
+                {
+                    outPos = outEnd = 0;
+                    ret = sendInPlace(stream, left, false);
+                    if (!ret.isError()) left -= (std::size_t)ret.getCount();
+                }
+                if (ret.isError() || left > recvBuffer.maxSize() - outEnd)
+                {
+                    SLog(Level::Warning, "Client %s: the socket didn't accept the answer's borrowed content, %u bytes are left", socket.address, (unsigned)left);
+                    outPos = outEnd = 0;
+                    forceCloseConnection();
+                    return false;
+                }
+            }
+            outEnd += (uint32)stream.read(recvBuffer.getHead() + outEnd, left);
+            if (outPos == outEnd) { outPos = outEnd = 0; return true; }
+            resumeFunc = &Client::resumePending;
+            return resumeFunc(*this, false);
+        }
+
+        /** Send the gathered answer without waiting for the socket. What the socket doesn't accept is sent in resumeSending()
+            @return false upon error */
+        bool sendPending()
+        {
+            outPos = 0;
+            outEnd = socket.stopGathering();
+            if (!outEnd) return true;
+            resumeFunc = &Client::resumePending;
+            return resumeFunc(*this, false);
+        }
+
+        /** Send as much as possible of the pending output without waiting (or drop it if aborting) */
+        static bool resumePending(Client & client, bool abort)
+        {
+            if (!abort && client.outPos < client.outEnd)
+            {
+                Error ret = client.socket.trySend((const char*)client.recvBuffer.getHead() + client.outPos, client.outEnd - client.outPos);
+                if (ret.isError()) abort = true;
+                else client.outPos += (uint32)ret.getCount();
+                // Socket is full, wait for it to be writable again
+                if (!abort && client.outPos < client.outEnd) return true;
+            }
+            client.resumeFunc = nullptr;
+            client.outPos = client.outEnd = 0;
+            return !abort;
+        }
+
+        /** Read the stream's next part in the buffer, after the pending output, within the shapers' tokens
+            @return the size read (0 at the end of the stream, or if the shapers' tokens aren't available yet, see isThrottled) */
+        template <typename Stream>
+        std::size_t readMore(Stream & stream)
+        {
+            uint8 * buffer = recvBuffer.getHead() + outEnd;
+            const std::size_t size = recvBuffer.maxSize() - outEnd;
+#if UseEgressShaping == 1
+            // Only read what the shapers allow to send now, else wait for their tokens (the server resumes this after throttleDelay)
+            const std::size_t allowed = takeTokens(size);
+            if (!allowed) return 0;
+            const std::size_t read = stream.read(buffer, allowed);
+            giveBackTokens(allowed - read);
+#else
+            const std::size_t read = stream.read(buffer, size);
+#endif
+            outEnd += (uint32)read;
+            return read;
+        }
+
+        /** Send as much as possible of the parked stream without waiting (or destruct it if aborting) */
+        template <typename Stream>
+        static bool resumeStream(Client & client, bool abort)
+        {
+            Stream & stream = *(Stream*)client.parkedStream;
+            const std::size_t quantum = client.sendQuantum();
+            std::size_t sent = 0;
+            while (!abort)
+            {
+                if (client.outPos < client.outEnd)
+                {
+                    Error ret = client.socket.trySend((const char*)client.recvBuffer.getHead() + client.outPos, client.outEnd - client.outPos);
+                    if (ret.isError()) { abort = true; break; }
+                    client.outPos += (uint32)ret.getCount();
+                    sent += (std::size_t)ret.getCount();
+                    // Socket is full, wait for it to be writable again
+                    if (client.outPos < client.outEnd) return true;
+                }
+                // Let the other clients be served before sending more (the server resumes this once the socket is writable, that is, soon)
+                if (quantum && sent >= quantum) return true;
+                // Nothing is pending anymore, even if the shapers make this wait
+                client.outPos = client.outEnd = 0;
+                if constexpr (Streams::InPlace<Stream>) if (client.canSendInPlace(stream))
+                {   // Send from the stream's mapping or its file, without reading it in the buffer
+                    std::size_t length = stream.getSize() - stream.getPos();
+#if UseZeroCopySend == 1
+                    // The answer is done once the system doesn't use its memory anymore. The socket is writable meanwhile, so this is
+                    // checked on each loop. If the client doesn't acknowledge the data in time, its connection is aborted below instead
+                    if (!length && client.socket.waitZeroCopy(0) == Timeout)
+                    {
+                        if (client.socket.getZeroCopyAge() < NonBlockingTimeout) return true;
+                        abort = true;
+                        break;
+                    }
+#endif
+                    if (!length) break;
+                    if (quantum) length = min(length, quantum - sent);
+#if UseEgressShaping == 1
+                    length = client.takeTokens(length);
+                    if (!length) return true;
+#endif
+                    Error ret = client.sendInPlace(stream, length, false);
+#if UseEgressShaping == 1
+                    client.giveBackTokens(length - (std::size_t)ret.getCount());
+#endif
+                    if (ret.isError()) { abort = true; break; }
+                    sent += (std::size_t)ret.getCount();
+                    // Socket is full, wait for it to be writable again
+                    if ((std::size_t)ret.getCount() < length) return true;
+                    continue;
+                }
+                if (!client.readMore(stream))
+                {
+#if UseEgressShaping == 1
+                    if (client.isThrottled()) return true;
+#endif
+                    break;
+                }
+            }
+#if UseZeroCopySend == 1
+            // The stream's memory is released below, so the system must not send from it anymore
+            if constexpr (Streams::Mappable<Stream>) if (abort) client.socket.dropZeroCopy();
+#endif
+            stream.~Stream();
+            client.parkedStream = nullptr;
+            client.resumeFunc = nullptr;
+            client.outPos = client.outEnd = 0;
+            return !abort;
+        }
+#endif
+
+#if UseRouteOffloading == 1
+        /** The offloading state for this client (see Offload) */
+        enum OffloadState : uint8
+        {
+            NotOffloaded = 0,   //!< The client is owned by the server
+            OffloadPending,     //!< A route's callback is waiting for the server to hand the client to a worker thread
+            OffloadRunning,     //!< A worker thread owns the client
+            OffloadDone,        //!< The worker thread is done with the client, the server can take it back
+        };
+        /** The current offloading state. It's written by the worker thread when it's done */
+        std::atomic<uint8> offloadState = NotOffloaded;
+        /** The function to run in the worker thread and its argument (the route's headers, saved in the vault) */
+        void        (*offloadFunc)(Client &, void * arg) = nullptr;
+        void *      offloadArg = nullptr;
+        /** The function the worker thread calls once it's done with the client, so the server takes it back, and its first argument */
+        void        (*offloadDone)(void * owner, Client &) = nullptr;
+        void *      offloadOwner = nullptr;
+
+        /** Check if this client is (or is about to be) owned by a worker thread */
+        bool isOffloaded() const { return offloadState.load(std::memory_order_acquire) != NotOffloaded; }
+        /** Check if the worker thread is done with this client (it's taken back by the server then) */
+        bool takeBack()
+        {
+            if (offloadState.load(std::memory_order_acquire) != OffloadDone) return false;
+            offloadState.store(NotOffloaded, std::memory_order_relaxed);
+            return true;
+        }
+        /** Hand this client to a worker thread. This is called by the server once the client's socket isn't monitored anymore
+            @param workers  The server's worker pool, its queues must have room for all the server's clients
+            @param done     The function called (from the worker thread) once the worker thread is done with the client
+            @param owner    The done function's first argument */
+        template <typename Workers>
+        void offload(Workers & workers, void (*done)(void * owner, Client &), void * owner)
+        {
+            offloadDone = done;
+            offloadOwner = owner;
+            offloadState.store(OffloadRunning, std::memory_order_relaxed);
+            // A client is only queued once at most, so this can't fail (the callback never runs in the server's thread)
+            workers.post({ &Client::runOffloaded, this });
+        }
+        /** Prepare running the given function in a worker thread (the server will call offload later on) */
+        void prepareOffload(void (*func)(Client &, void *), void * arg)
+        {
+            offloadFunc = func;
+            offloadArg = arg;
+            offloadState.store(OffloadPending, std::memory_order_relaxed);
+        }
+
+    private:
+        static void runOffloaded(void * arg)
+        {
+            Client & client = *(Client*)arg;
+            client.offloadFunc(client, client.offloadArg);
+            client.offloadFunc = nullptr;
+            client.offloadArg = nullptr;
+            void (*done)(void *, Client &) = client.offloadDone;
+            client.offloadState.store(OffloadDone, std::memory_order_release);
+            done(client.offloadOwner, client);
+        }
+    public:
+#endif
+
+#if UseCoroutineRoutes == 1
+        /** What the route's coroutine is waiting for */
+        enum AwaitState : uint8
+        {
+            NotAwaiting = 0,    //!< The coroutine is running (or there's none)
+            AwaitingData,       //!< The coroutine waits for more data in the receive buffer
+            AwaitingWritable,   //!< The coroutine waits for the socket to be writable
+            AwaitingTimer,      //!< The coroutine waits for wakeUpDelay ms
+        };
+        /** The suspended route's coroutine (if any) */
+        std::coroutine_handle<> routeCoroutine;
+        /** The function destructing the coroutine's headers (saved in the vault) and its argument */
+        void        (*routeCleanup)(void * arg) = nullptr;
+        void *      routeArg = nullptr;
+        /** The delay to wait for in ms when awaiting a timer */
+        uint32      wakeUpDelay = 0;
+        AwaitState  awaiting = NotAwaiting;
+        /** The value returned by the route's coroutine */
+        bool        routeResult = false;
+
+        /** Check if the route's coroutine is waiting for something */
+        bool isSuspended() const { return awaiting != NotAwaiting; }
+
+        /** Wait until more data is received. The new data is appended to the receive buffer, so the coroutine should consume
+            the buffer (with recvBuffer.resetTranscient(0)) before waiting again.
+            @return (upon co_await) the size of the data in the receive buffer. If the buffer is full, this doesn't wait */
+        auto recvMore()
+        {
+            struct Awaiter
+            {
+                Client & client;
+                bool await_ready() const { return !client.recvBuffer.freeSize(); }
+                void await_suspend(std::coroutine_handle<>) { client.awaiting = AwaitingData; }
+                std::size_t await_resume() const { return client.recvBuffer.getSize(); }
+            };
+            return Awaiter{*this};
+        }
+        /** Wait until the socket is writable (so the next send doesn't block) */
+        auto writable()
+        {
+            struct Awaiter
+            {
+                Client & client;
+                bool await_ready() const { return false; }
+                void await_suspend(std::coroutine_handle<>) { client.awaiting = AwaitingWritable; }
+                void await_resume() const {}
+            };
+            return Awaiter{*this};
+        }
+
+        /** End the current request once the route's coroutine sent its answer by itself (with sendStatus, sendSize and the socket).
+            The client is then ready for the next request, the route's headers aren't valid anymore */
+        bool endAnswer() { parsingStatus = ReqDone; reset(); return true; }
+
+        /** Start tracking a route's coroutine once it has run up to its first suspension point (or its end)
+            @param coroutine    The coroutine's handle
+            @param cleanup      The function to call once the coroutine is done (with the given argument) */
+        ClientState startRoute(std::coroutine_handle<> coroutine, void (*cleanup)(void *), void * arg)
+        {
+            routeCoroutine = coroutine;
+            routeCleanup = cleanup;
+            routeArg = arg;
+            return routeState();
+        }
+        /** Resume the route's coroutine now that what it was waiting for happened */
+        ClientState resumeRoute()
+        {
+            awaiting = NotAwaiting;
+            routeCoroutine.resume();
+            return routeState();
+        }
+
+    private:
+        /** Check the coroutine's state once it's suspended (or done) */
+        ClientState routeState()
+        {
+            if (!routeCoroutine.done())
+            {
+                if (isSuspended()) return ClientState::Suspended;
+                // The coroutine awaited something that the server can't resume
+                destroyRoute();
+                closeWithError(Code::InternalServerError);
+                return ClientState::Error;
+            }
+            destroyRoute();
+            return routeResult ? ClientState::Done : ClientState::Error;
+        }
+        /** Destroy the coroutine's frame and its headers */
+        void destroyRoute()
+        {
+            routeCoroutine.destroy();
+            routeCoroutine = nullptr;
+            if (routeCleanup) routeCleanup(routeArg);
+            routeCleanup = nullptr;
+            routeArg = nullptr;
+            awaiting = NotAwaiting;
+        }
+    public:
+#endif
+
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+        /** Check if this client waits for its socket to be writable (to continue sending its answer or to resume its route's coroutine) */
+        bool isWaitingToSend() const
+        {
+#if UseNonBlockingSocket == 1
+            if (isSending()) return true;
+#endif
+#if UseCoroutineRoutes == 1
+            if (awaiting == AwaitingWritable) return true;
+#endif
+            return false;
+        }
+#endif
+
         bool sendStatus(Code replyCode)
         {
+            if (const StatusLine * line = getStatusLine(replyCode))
+            {
+                socket.send(line->text, line->length);
+                return true;
+            }
+            // Unknown code, build its status line
             char buffer[5] = { };
             intToStr((int)replyCode, buffer, 10);
             buffer[3] = ' ';
@@ -177,6 +803,10 @@ namespace Network::Servers::HTTP
             return true;
         }
         bool sendSize(std::size_t length) { return Common::HTTP::sendSize(socket, length); }
+        /** Answer with the given message (as text/plain).
+            The message can be in any memory (like a local buffer): with non blocking sockets, what the socket doesn't accept at once is copied
+            in the client's buffer. A message larger than this buffer must be sent at once, else the connection is closed, so a large content
+            should be sent with a FileAnswer<Streams::StaticView> (for a static content) or any owning stream instead */
         bool reply(Code statusCode, const ROString & msg, bool close = false);
         bool reply(Code statusCode);
 
@@ -216,6 +846,49 @@ namespace Network::Servers::HTTP
             return ClientState::NeedRefill;
         }
 
+#if UseNonBlockingSocket == 1
+        /** Check if the request's content must be received before calling the route's callback, so fetchContent doesn't wait for it.
+            The route's headers are saved in the vault meanwhile and the server receives the content in the loop. This is only done if
+            the content fits in the buffer (else, the route's callback must be offloaded to receive it, see Offload)
+            @return true if the content is awaited */
+        template <typename H>
+        bool awaitContent(H & headers)
+        {
+            if constexpr (H::hasHeader(Headers::ContentLength))
+            {
+                const std::size_t length = headers.template getHeader<Headers::ContentLength>().getValueElement(0);
+                if (recvBuffer.getSize() >= length) return false;
+                const uint32 vault = recvBuffer.vaultSize();
+                if (!headers.saveInVault(recvBuffer) || recvBuffer.maxSize() < length)
+                {
+                    recvBuffer.resetVault(vault);
+                    return false;
+                }
+                persistVaultSize = vault;
+                parsingStatus = RecvContent;
+                return true;
+            }
+            else return false;
+        }
+        /** Reload the route's headers once its content is received (see awaitContent) */
+        template <typename H>
+        void contentReceived(H & headers)
+        {
+            routeFound(headers);
+            parsingStatus = HeadersDone;
+        }
+#endif
+        /** Check if the missing request's content can be waited for. With non blocking sockets, only a worker thread can wait
+            for it (see Offload), the server's thread receives it before calling the route's callback instead (see awaitContent) */
+        bool canWaitForContent() const
+        {
+#if UseNonBlockingSocket == 1 && UseRouteOffloading == 1
+            return offloadState.load(std::memory_order_relaxed) == OffloadRunning;
+#else
+            return UseNonBlockingSocket != 1;
+#endif
+        }
+
         template <typename T>
         bool fetchContent(const auto & headers, T & content)
         {
@@ -243,7 +916,9 @@ namespace Network::Servers::HTTP
                         if (recvBuffer.getSize() < expLength)
                         {
                             // Need to fetch the missing content
-                            Error ret = socket.recv((char*)recvBuffer.getTail(), expLength - recvBuffer.getSize());
+                            if (!canWaitForContent()) return false;
+                            const uint32 missing = (uint32)(expLength - recvBuffer.getSize());
+                            Error ret = socket.recv((char*)recvBuffer.getTail(), missing, missing);
                             if (ret.isError()) return false;
                             recvBuffer.stored(ret.getCount());
                         }
@@ -256,12 +931,15 @@ namespace Network::Servers::HTTP
                     if constexpr(requires{ content.write((char*)0, 0); })
                     {
                         // Save what we've already received
-                        std::size_t len = content.write(recvBuffer.getHead(), recvBuffer.getSize());
-                        if (len != recvBuffer.getSize()) return false;
+                        const std::size_t received = min((std::size_t)recvBuffer.getSize(), expLength);
+                        std::size_t len = content.write(recvBuffer.getHead(), received);
+                        if (len != received) return false;
                         recvBuffer.resetTranscient(0);
 
-                        Streams::Socket in(socket);
                         expLength -= len;
+                        if (!expLength) return true;
+                        if (!canWaitForContent()) return false;
+                        Streams::Socket in(socket);
                         len = Streams::copy(in, content, recvBuffer.getTail(), recvBuffer.freeSize(), expLength);
                         return len == expLength;
                     }
@@ -324,6 +1002,7 @@ namespace Network::Servers::HTTP
                     return true;
                 }
             case HeadersDone:
+            case RecvContent:
             case ReqDone: break;
             }
             return true;
@@ -332,32 +1011,67 @@ namespace Network::Servers::HTTP
         ROString getRequestedPath() const { return reqLine.URI.onlyPath(); }
         /** Check if the client is valid */
         bool isValid() const { return socket.isValid(); }
-        /** Decrease time to live (and close the socket if required)
-            @return true if closed */
-        bool tickTimeToLive() {
-            if (!timeToLive) return false;
-            if (--timeToLive == 0)
-            {
-                reset();
-                return true;
-            }
-            return false;
-        }
         /** Socket was accepted */
         void accepted() { timeToLive = 255; }
         /** Socket was remotely closed */
         void closed() { timeToLive = 0; reset(); }
+        /** Check if the client is waiting for a new request and has nothing saved in its buffer */
+        bool isIdle() const { return parsingStatus == Invalid && !recvBuffer.getSize() && !recvBuffer.vaultSize(); }
+        /** Get the size that can be received in the buffer. While receiving the headers, RouteHeadersReserve bytes are kept free for
+            copying the route's headers to the vault (unless the headers wouldn't fit otherwise) */
+        uint32 receivableSize() const
+        {
+            const uint32 size = recvBuffer.freeSize();
+#if UseCoroutineRoutes == 1 || UseRouteOffloading == 1
+            if (parsingStatus < HeadersDone && size > RouteHeadersReserve) return size - RouteHeadersReserve;
+#endif
+            return size;
+        }
+
+#if UseSharedRecvBuffers == 1
+        /** Take a receive buffer from the shared pool, if none is attached yet
+            @return false if no buffer is available */
+        bool attachBuffer()
+        {
+            if (recvBuffer.isAttached()) return true;
+            uint8 * buffer = (uint8*)getBufferPool().acquire(ClientBufferSize);
+            if (!buffer) return false;
+            recvBuffer.attach(buffer);
+            return true;
+        }
+        /** Give back the receive buffer to the shared pool. The buffer's content is lost */
+        void releaseBuffer() { if (recvBuffer.isAttached()) getBufferPool().release(recvBuffer.detach()); }
+
+    private:
+        /** The pool is shared by all the clients (of all servers), it's thread safe */
+        typedef Container::BlockPool<SharedRecvBufferCount, ClientBufferSize> BufferPool;
+        static BufferPool & getBufferPool() { static BufferPool pool; return pool; }
+#endif
 
 
     protected:
         /** Reset this client state and buffer. This is called from the server's accept method before actually using the client */
         void reset() {
+#if UseNonBlockingSocket == 1
+            // Abort any pending answer
+            if (resumeFunc) resumeFunc(*this, true);
+#endif
+#if UseCoroutineRoutes == 1
+            // Abort the suspended route's coroutine (a running coroutine can reset the client when it's done answering, it's destroyed when it returns)
+            if (isSuspended()) destroyRoute();
+#endif
             recvBuffer.reset();
             reqLine.reset();
             parsingStatus = Invalid;
             if (!timeToLive) socket.reset();
             answerLength = 0;
             persistVaultSize = 0;
+            sendPriority = SendPriority::Normal;
+#if UseEgressShaping == 1
+            shaper.rate = 0;
+            globalShaping = false;
+            throttleDelay = 0;
+#endif
         }
     };
 
@@ -389,7 +1103,9 @@ namespace Network::Servers::HTTP
 #if MinimizeStackSize == 1
             return ClientAnswer::CommonHeader::sendHeaders(client.socket);
 #else
-            Container::TrackedBuffer buffer { client.recvBuffer.getTail(), client.recvBuffer.freeSize() };
+            // Build the headers after the gathered status line, so they aren't copied to it
+            const uint32 gathered = client.socket.gatheredSize();
+            Container::TrackedBuffer buffer { client.recvBuffer.getTail() + gathered, client.recvBuffer.freeSize() - gathered };
             return ClientAnswer::CommonHeader::sendHeaders(client.socket, buffer);
 #endif
         }
@@ -397,14 +1113,17 @@ namespace Network::Servers::HTTP
         bool sendContent(Client & client, std::size_t & totalSize) {
 
             if constexpr (&Child::sendContent != &ClientAnswer::sendContent)
+            {   // The content can use the buffer
+                client.socket.uncork();
                 return c()->sendContent(client, totalSize);
+            }
             else return true;
         }
         ClientAnswer(Code code = Code::Invalid) : ClientAnswer::CommonHeader(code) {}
     };
 
 
-    /** A simple answer with the given MIME type and message */
+    /** A simple answer with the given MIME type and message. The message is borrowed (see Client::reply) */
     template <MIMEType m = MIMEType::text_plain>
     struct SimpleAnswer : public ClientAnswer<SimpleAnswer<m>, Headers::ContentType>
     {
@@ -472,19 +1191,31 @@ namespace Network::Servers::HTTP
         }
 
         // Proxy the ClientAnswer interface here, using headers' member
+        /** The pieces are coalesced in the client's free buffer (after the gathered head) and sent as a chunk once ChunkWatermark bytes are
+            buffered. A callback taking a Streams::BufferedChunkedOutput & can flush it to send the pieces so far without waiting for more.
+            With non blocking sockets, the callback is moved to the client's vault and called while the socket can accept more data, so it
+            might be called after the route's callback returned: it must own what it uses (capture by value) */
         bool sendContent(Client & client, std::size_t & totalSize) {
-            Streams::ChunkedOutput o{client.socket};
+#if UseNonBlockingSocket == 1
+            client.answerLength = 0;
+            Chunks chunks{ std::move(callbackFunc), client.answerLength, {}, false };
+            if (!client.sendStream(chunks)) return false;
+            totalSize = client.answerLength;
+            return true;
+#else
+            const uint32 gathered = client.socket.gatheredSize();
+            Streams::BufferedChunkedOutput o{client.socket, (char*)client.recvBuffer.getTail() + gathered, client.recvBuffer.freeSize() - gathered, ChunkWatermark};
             totalSize = 0;
-            ROString s = callbackFunc();
+            ROString s = next(callbackFunc, o);
             while (s)
             {
-                if (o.write(s.getData(), s.getLength()) != s.getLength()) return false;
+                if (o.write(s.getData(), s.getLength()) != (std::size_t)s.getLength()) return false;
                 totalSize += (std::size_t)s.getLength();
-                s = callbackFunc();
+                s = next(callbackFunc, o);
             }
             // Need to finish sending the flux
-            o.write(nullptr, 0);
-            return true;
+            return o.close();
+#endif
         }
         template <Headers h, typename Value>
         void setHeaderIfUnset(Value && v) { headers.template setHeaderIfUnset<h>(std::forward<Value>(v)); }
@@ -496,6 +1227,42 @@ namespace Network::Servers::HTTP
         bool sendHeaders(Client & client) { return headers.sendHeaders(client); }
         operator HS & () { return headers; }
 
+        /** Get the next piece of the answer from the callback */
+        static ROString next(T & callbackFunc, Streams::BufferedChunkedOutput & o)
+        {
+            if constexpr (std::is_invocable_v<T&, Streams::BufferedChunkedOutput&>) return callbackFunc(o);
+            else return callbackFunc();
+        }
+
+#if UseNonBlockingSocket == 1
+        /** The pieces read as chunks, so the answer is parked like a stream answer (see Client::sendStream).
+            A piece that doesn't fit in the chunk is continued in the next one, but a callback's own write only takes what fits (see
+            Streams::BufferedChunkedOutput::write) */
+        struct Chunks
+        {
+            T callbackFunc;
+            /** The size of the pieces read so far */
+            std::size_t & totalSize;
+            /** The part of the last piece that didn't fit in the previous chunk */
+            ROString rest;
+            bool done = false;
+
+            std::size_t read(void * buf, const std::size_t size)
+            {
+                if (done) return 0;
+                Streams::BufferedChunkedOutput o{(char*)buf, size, ChunkWatermark};
+                while (!o.isReady())
+                {
+                    if (!rest && !(rest = next(callbackFunc, o))) { done = true; break; }
+                    const std::size_t length = o.write(rest.getData(), rest.getLength());
+                    totalSize += length;
+                    (void)rest.splitAt(length);
+                }
+                return o.take(done);
+            }
+        };
+#endif
+
         /** Aggregate header type */
         HS headers;
         /** The lambda function we've captured */
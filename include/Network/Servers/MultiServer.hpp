@@ -0,0 +1,109 @@
+#ifndef hpp_MultiServer_hpp
+#define hpp_MultiServer_hpp
+
+// We need the server and routes declaration
+#include "Route.hpp"
+// We need threads
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+namespace Network::Servers::HTTP
+{
+    /** A server running one independent Server per CPU core.
+        Each Server has its own listening socket (all bound to the same port with SO_REUSEPORT, so the system spreads the incoming connections
+        between them), its own clients array and its own thread, pinned to a core.
+        Nothing is shared between the servers and a connection never moves from one server to another, so the route's callbacks don't need
+        any lock as long as they only deal with their client (but they can be called from different threads concurrently).
+
+        All the servers are allocated upon construction, MaxThreads limits the number of servers that can be started.
+        @param Router           The router to use for all the servers
+        @param ClientsPerCore   The maximum number of clients for each server
+        @param MaxThreads       The maximum number of servers (and threads)
+        @param Engine           The server type for each thread (can be a URingServer on Linux) */
+    template <auto Router, std::size_t ClientsPerCore = 4, std::size_t MaxThreads = 8, typename Engine = Server<Router, ClientsPerCore>>
+    struct MultiServer
+    {
+        /** The servers, one per thread */
+        Engine                  servers[MaxThreads];
+        /** The number of servers actually running */
+        std::size_t             serverCount = 0;
+
+        /** Create all the servers and start their threads
+            @param port         The port to listen to
+            @param threadCount  The number of servers to start. If 0, one per online CPU (up to MaxThreads)
+            @param options      The listening sockets' options (the port is always shared)
+            @return Success or any error from creating a server or a thread */
+        Error create(uint16 port, std::size_t threadCount = 0, ListenOptions options = {})
+        {
+            options.sharePort = true;
+            if (!threadCount) threadCount = getCPUCount();
+            threadCount = min(threadCount, MaxThreads);
+
+            running = true;
+            for (serverCount = 0; serverCount < threadCount; serverCount++)
+            {
+                if (Error ret = servers[serverCount].create(port, options); ret.isError()) { stop(); return ret; }
+                threads[serverCount].parent = this;
+                threads[serverCount].index = serverCount;
+                if (pthread_create(&threads[serverCount].thread, 0, &MultiServer::run, &threads[serverCount]) != 0) { stop(); return AllocationFailure; }
+            }
+            SLog(Level::Info, "HTTP multi server started %u servers", (unsigned)serverCount);
+            return Success;
+        }
+
+        /** Stop all the servers' thread and wait for them to finish.
+            The servers are only stopped in their next loop iteration (so after the current client is processed) */
+        void stop()
+        {
+            running = false;
+            for (std::size_t i = 0; i < serverCount; i++) pthread_join(threads[i].thread, 0);
+            serverCount = 0;
+        }
+
+        /** Check if the servers are running */
+        bool isRunning() const { return running; }
+
+        MultiServer() {}
+        ~MultiServer() { stop(); }
+
+    private:
+        /** The per server thread */
+        struct Thread
+        {
+            pthread_t       thread;
+            MultiServer *   parent;
+            std::size_t     index;
+        };
+        Thread              threads[MaxThreads];
+        std::atomic<bool>   running = false;
+
+        static std::size_t getCPUCount()
+        {
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            return count > 0 ? (std::size_t)count : 1;
+        }
+
+        static void * run(void * arg)
+        {
+            Thread & self = *(Thread*)arg;
+#if defined(__linux__)
+            // Pin the thread to a single core, so the server's data stays in this core's cache
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(self.index % getCPUCount(), &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+            Engine & server = self.parent->servers[self.index];
+            while (self.parent->running)
+            {
+                // An error here only concerns this server's current client, so let's continue serving the others
+                if (Error ret = server.loop(); ret.isError())
+                    SLog(Level::Error, "Server %u loop error: %d", (unsigned)self.index, (int)ret);
+            }
+            return 0;
+        }
+    };
+}
+
+#endif
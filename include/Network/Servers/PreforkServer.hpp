@@ -0,0 +1,210 @@
+#ifndef hpp_PreforkServer_hpp
+#define hpp_PreforkServer_hpp
+
+// We need the server and routes declaration
+#include "Route.hpp"
+// We need processes and shared memory
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__linux__)
+  #include <sys/prctl.h>
+#endif
+// We need placement new
+#include <new>
+
+#if UseServerStats != 1
+  #error "The prefork server requires UseServerStats to be set to 1"
+#endif
+
+namespace Network::Servers::HTTP
+{
+    /** A supervisor running one Server per worker process, for isolating the crashes while using multiple cores.
+        The supervisor (the parent process) creates the listening socket and forks the workers, which inherit it, so the system spreads the
+        incoming connections between them. A worker that dies is restarted by the supervisor (see supervise), and the other workers are
+        unaffected meanwhile.
+        Each worker's counters (see ServerStats) are in a shared memory segment mapped before forking, so the supervisor can read (and
+        expose) them, and they survive a worker's restart.
+
+        The worker's server is constructed in the worker (so its descriptors, like an epoll's one, aren't shared with the other workers), in
+        a storage allocated with this object, so a forked worker doesn't allocate anything.
+        Like with a MultiServer, nothing is shared between the workers, but unlike it, the route's callbacks run in different processes, so
+        any state they change isn't seen by the other workers (nor the supervisor).
+        @param Router           The router to use for all the workers
+        @param ClientsPerWorker The maximum number of clients for each worker
+        @param MaxWorkers       The maximum number of workers
+        @param Engine           The server type for each worker (can be a URingServer on Linux) */
+    template <auto Router, std::size_t ClientsPerWorker = 4, std::size_t MaxWorkers = 8, typename Engine = Server<Router, ClientsPerWorker>>
+    struct PreforkServer
+    {
+        /** The counters shared between the supervisor and the workers */
+        struct SharedStats
+        {
+            /** Each worker's counters */
+            ServerStats         workers[MaxWorkers];
+            /** The number of times a worker was restarted */
+            std::atomic<uint32> restarts = 0;
+
+            /** Sum the given counter for all the workers (like stats->total(&ServerStats::requests)) */
+            uint64 total(ServerStats::Counter ServerStats::*counter) const
+            {
+                uint64 sum = 0;
+                for (const ServerStats & worker : workers) sum += (worker.*counter).get();
+                return sum;
+            }
+        };
+
+        /** The counters, in shared memory (valid once created) */
+        SharedStats *           stats = nullptr;
+        /** The number of workers actually running */
+        std::size_t             workerCount = 0;
+
+        /** Create the listening socket and start the workers
+            @param port         The port to listen to
+            @param count        The number of workers to start. If 0, one per online CPU (up to MaxWorkers)
+            @param options      The listening socket's options
+            @return Success or any error from creating the listening socket, the shared memory or a worker */
+        Error create(uint16 port, std::size_t count = 0, ListenOptions options = {})
+        {
+            if (!options.backlog) options.backlog = (int)max(ClientsPerWorker * (count ? count : getCPUCount()), (std::size_t)ListenBacklog);
+            if (Error ret = listener.listen(port, options); ret.isError()) return ret;
+            void * memory = ::mmap(nullptr, sizeof(SharedStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return AllocationFailure;
+            stats = new (memory) SharedStats;
+
+            this->port = port;
+            this->options = options;
+            this->options.listenDescriptor = listener.socket;
+            if (!count) count = getCPUCount();
+            count = min(count, MaxWorkers);
+            for (workerCount = 0; workerCount < count; workerCount++)
+                if (Error ret = startWorker(workerCount); ret.isError()) { stop(); return ret; }
+            SLog(Level::Info, "HTTP prefork server started %u workers", (unsigned)workerCount);
+            return Success;
+        }
+
+        /** Restart the workers that died. The supervisor should call this periodically, it doesn't wait.
+            A worker that can't be restarted (like if the system can't fork now) is retried on the next calls, with a delay doubled on
+            each failure (from MinRestartDelayMs to MaxRestartDelayMs)
+            @return the number of restarted workers */
+        std::size_t supervise()
+        {
+            const uint32 now = getMonotonicTimeMs();
+            int status = 0;
+            pid_t pid;
+            while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                for (std::size_t i = 0; i < workerCount; i++)
+                {
+                    if (pids[i] != pid) continue;
+                    SLog(Level::Warning, "Worker %u (%d) died (status %d), restarting it", (unsigned)i, (int)pid, status);
+                    pids[i] = -1;
+                    restartTime[i] = now;
+                    break;
+                }
+            }
+
+            std::size_t restarted = 0;
+            for (std::size_t i = 0; i < workerCount; i++)
+            {
+                if (pids[i] != -1 || (int32)(now - restartTime[i]) < 0) continue;
+                if (startWorker(i).isError())
+                {
+                    restartDelay[i] = restartDelay[i] ? min(restartDelay[i] * 2, MaxRestartDelayMs) : MinRestartDelayMs;
+                    restartTime[i] = now + restartDelay[i];
+                    SLog(Level::Error, "Can't restart worker %u, retrying in %ums", (unsigned)i, (unsigned)restartDelay[i]);
+                    continue;
+                }
+                restartDelay[i] = 0;
+                stats->restarts.fetch_add(1, std::memory_order_relaxed);
+                ++restarted;
+            }
+            return restarted;
+        }
+
+        /** Stop all the workers and wait for them to finish.
+            The workers are only stopped in their next loop iteration (so after their current client is processed) */
+        void stop()
+        {
+            for (std::size_t i = 0; i < workerCount; i++) if (pids[i] > 0) ::kill(pids[i], SIGTERM);
+            for (std::size_t i = 0; i < workerCount; i++) if (pids[i] > 0) ::waitpid(pids[i], nullptr, 0);
+            for (std::size_t i = 0; i < workerCount; i++) pids[i] = -1;
+            workerCount = 0;
+        }
+
+        /** Check if the workers are running */
+        bool isRunning() const { return workerCount != 0; }
+
+        PreforkServer() { for (pid_t & pid : pids) pid = -1; }
+        ~PreforkServer()
+        {
+            stop();
+            if (stats) { stats->~SharedStats(); ::munmap(stats, sizeof(SharedStats)); }
+        }
+
+    private:
+        /** The listening socket, inherited by the workers */
+        BaseSocket          listener;
+        /** The options for the workers' servers */
+        ListenOptions       options;
+        uint16              port = 0;
+        /** The workers' process identifiers (-1 if not running) */
+        pid_t               pids[MaxWorkers];
+        /** The delay before retrying to start a worker that failed to start (in ms) */
+        static constexpr uint32 MinRestartDelayMs = 100, MaxRestartDelayMs = 10000;
+        /** For each worker that isn't running, the time to try restarting it, and the last delay used (0 if it didn't fail) */
+        uint32              restartTime[MaxWorkers] = {};
+        uint32              restartDelay[MaxWorkers] = {};
+        /** The storage for the worker's server, only constructed in the worker (each worker has its own copy once forked) */
+        alignas(Engine) uint8 serverStorage[sizeof(Engine)];
+
+        static std::size_t getCPUCount()
+        {
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            return count > 0 ? (std::size_t)count : 1;
+        }
+
+        /** Set when a worker must stop (from its signal handler) */
+        static volatile sig_atomic_t & stopping() { static volatile sig_atomic_t flag = 0; return flag; }
+
+        /** Fork a worker for the given index */
+        Error startWorker(const std::size_t index)
+        {
+            pid_t pid = ::fork();
+            if (pid < 0) return AllocationFailure;
+            if (pid > 0) { pids[index] = pid; return Success; }
+            runWorker(index);
+        }
+
+        /** The worker's process, it never returns */
+        [[noreturn]] void runWorker(const std::size_t index)
+        {
+            struct sigaction action = {};
+            action.sa_handler = [](int) { stopping() = 1; };
+            ::sigaction(SIGTERM, &action, nullptr);
+#if defined(__linux__)
+            // Don't outlive the supervisor
+            ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (::getppid() == 1) ::_exit(0);
+#endif
+            Engine & server = *new (serverStorage) Engine;
+            server.stats = &stats->workers[index];
+            if (Error ret = server.create(port, options); ret.isError())
+            {
+                SLog(Level::Error, "Worker %u can't start: %d", (unsigned)index, (int)ret);
+                ::_exit(1);
+            }
+            while (!stopping())
+            {
+                // An error here only concerns this worker's current client, so let's continue serving the others
+                if (Error ret = server.loop(); ret.isError())
+                    SLog(Level::Error, "Worker %u loop error: %d", (unsigned)index, (int)ret);
+            }
+            // Don't run the supervisor's destructors in the worker
+            ::_exit(0);
+        }
+    };
+}
+
+#endif
@@ -4,6 +4,29 @@
 // We need Client declaration
 #include "HTTP.hpp"
 #include "Tools/FuncRef.hpp"
+// We need the timer wheel for the clients' deadlines
+#include "Container/TimerWheel.hpp"
+#if UseIdleEviction == 1
+  // We need the list of the idle clients, ordered by their last activity
+  #include "Container/LRUList.hpp"
+#endif
+#if UseCoroutineRoutes == 1
+  // We need the coroutine routes
+  #include "Coroutine.hpp"
+#endif
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+  // We need the lock free queue for the tasks posted by other threads (and the clients the worker threads are done with)
+  #include "Threading/MPSCQueue.hpp"
+  #include <bit>
+#endif
+#if UseRouteOffloading == 1
+  // We need the worker threads for offloaded routes
+  #include "Threading/WorkerPool.hpp"
+#endif
+#if UseServerStats == 1
+  // We need atomic counters, readable from other threads
+  #include <atomic>
+#endif
 
 // We need offsetof for making the container_of macro
 #include <cstddef>
@@ -44,13 +67,6 @@ namespace Network::Servers::HTTP
         >>{}); // Who said we can't feed brainfuck to C++ compiler?
     };
 
-#ifndef SLog
-    // If no log function defined, let's define a no-op stub here
-    template <typename ... Args>
-    constexpr void noLog(Network::Level, const char*, Args && ...) {}
-    #define SLog noLog
-#endif
-
     /** This is use to share the common code for all template specialization to avoid code bloat */
     struct RouteHelper
     {
@@ -212,7 +228,13 @@ namespace Network::Servers::HTTP
             return h;
         };
 
-        ClientState state = client.parsingStatus == Client::HeadersDone && !client.hasPersistedHeaders() ? RouteHelper::parse(client, cb) : RouteHelper::parsePersist(client.routeFound(headers), cb);
+        ClientState state = ClientState::Processing;
+#if UseNonBlockingSocket == 1
+        // The headers were parsed before receiving the content, so reload them
+        if (client.parsingStatus == Client::RecvContent) client.contentReceived(headers);
+        else
+#endif
+        state = client.parsingStatus == Client::HeadersDone && !client.hasPersistedHeaders() ? RouteHelper::parse(client, cb) : RouteHelper::parsePersist(client.routeFound(headers), cb);
         if (state == ClientState::NeedRefill)
         {
             return client.saveHeaders(headers);
@@ -221,11 +243,107 @@ namespace Network::Servers::HTTP
         {   // Ok, the headers were accepted, let's start processing this route
             if (headers.template getHeader<Headers::Connection>().getValueElement(0) == Connection::close)
                 client.forceCloseConnection();
-            return CallbackCRTP(client, headers) ? ClientState::Done : ClientState::Error;
+#if UseCoroutineRoutes == 1
+            // The callback is a coroutine, it'll be resumed by the server when it waits for something
+            if constexpr (std::is_same_v<decltype(CallbackCRTP(client, headers)), RouteTask>)
+                return startCoroutine<CallbackCRTP>(client, headers);
+            else
+            {
+#endif
+#if UseNonBlockingSocket == 1
+            // Receive the content in the loop before calling the callback, instead of waiting for it in fetchContent
+            if (client.awaitContent(headers)) return ClientState::NeedRefill;
+#endif
+            bool done = CallbackCRTP(client, headers);
+#if UseRouteOffloading == 1
+            // The callback will run in a worker thread
+            if (client.isOffloaded()) return ClientState::Offloaded;
+#endif
+            return done ? ClientState::Done : ClientState::Error;
+#if UseCoroutineRoutes == 1
+            }
+#endif
         }
         return state;
     }
 
+#if UseRouteOffloading == 1
+    /** Run a route's callback in a worker thread instead of the server's loop.
+        This is useful for callbacks that take a long time (like receiving a large upload with fetchContent), since the other
+        clients are served meanwhile. The client's socket isn't monitored by the server while the worker thread owns it
+        and the client goes back to the server when the callback returns.
+        The parsed headers are copied in the client's vault. If they don't fit, the callback is called directly.
+        Since the callback runs in another thread, it must not access any state shared with other routes without synchronization.
+        Usage:
+        @code
+            Route<Offload<UploadFirmware>{}, MethodsMask{Method::POST}, "/upload", Headers::ContentLength>{}
+        @endcode */
+    template <RouteCallback auto Callback>
+    struct Offload
+    {
+        template <typename H>
+        bool operator()(Client & client, const H & headers) const
+        {
+            if constexpr (std::is_copy_constructible_v<H>)
+            {
+                if (uint8 * p = client.recvBuffer.reserveInVault(sizeof(H) + alignof(H) - 1))
+                {
+                    p = (uint8*)(((uintptr_t)p + alignof(H) - 1) & ~(uintptr_t)(alignof(H) - 1));
+                    client.prepareOffload(&Offload::run<H>, new (p) H(headers));
+                    return true;
+                }
+            }
+            return Callback(client, headers);
+        }
+
+    private:
+        template <typename H>
+        static void run(Client & client, void * arg)
+        {
+            H & headers = *(H*)arg;
+            Callback(client, headers);
+            headers.~H();
+        }
+    };
+#endif
+
+    /** Set the priority of a route's answer when it's sent in slices (see SendQuantum), so a large download can leave more room to the
+        other answers (or the opposite).
+        Usage:
+        @code
+            Route<Prioritized<DownloadFirmware, SendPriority::Background>{}, MethodsMask{Method::GET}, "/firmware.bin">{}
+        @endcode */
+    template <RouteCallback auto Callback, SendPriority priority>
+    struct Prioritized
+    {
+        template <typename H>
+        auto operator()(Client & client, const H & headers) const
+        {
+            client.sendPriority = priority;
+            return Callback(client, headers);
+        }
+    };
+
+#if UseEgressShaping == 1
+    /** Limit the rate of a route's answer (in bytes per second, 0 for no limit), and make it share the global rate (GlobalSendRate) with
+        the other answers shaped with the global bucket if global is true.
+        Only the parked part of the answer (like a FileAnswer's content) is shaped, each answer starts with a full burst (see ShaperBurstMs).
+        Usage:
+        @code
+            Route<Shaped<DownloadFirmware, 64 * 1024>{}, MethodsMask{Method::GET}, "/firmware.bin">{}
+        @endcode */
+    template <RouteCallback auto Callback, uint32 bytesPerSecond, bool global = true>
+    struct Shaped
+    {
+        template <typename H>
+        auto operator()(Client & client, const H & headers) const
+        {
+            client.shapeAnswer(bytesPerSecond, global);
+            return Callback(client, headers);
+        }
+    };
+#endif
+
     /** A HTTP route that's accepted by this server. You'll define a list of routes with those in Router object declaration */
     template <RouteCallback auto CallbackCRTP,  MethodsMask methods, CompileTime::str route, Headers ... allowedHeaders>
     struct Route final : public RouteHelper
@@ -286,25 +404,128 @@ namespace Network::Servers::HTTP
     };
 
 
+#if UseServerStats == 1
+    /** The counters of a server's activity.
+        They are only written by the server's thread, but they can be read from any thread (or process, when they are in shared memory) */
+    struct ServerStats
+    {
+        /** A counter with a single writer, so it's incremented without any locked instruction */
+        struct Counter
+        {
+            std::atomic<uint64> value = 0;
+
+            void operator++() { value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+            uint64 get() const { return value.load(std::memory_order_relaxed); }
+        };
+        static_assert(std::atomic<uint64>::is_always_lock_free, "The counters must be lock free to be shared between processes");
+
+        /** The accepted connections */
+        Counter accepted;
+        /** The requests given to the router */
+        Counter requests;
+        /** The clients closed because their deadline expired */
+        Counter timedOut;
+    };
+#endif
+
     /** The server itself.
         The server roles is to maintain a list of client's resources and perform the network activity work
         That is:
         1. Monitoring for network activity
         2. Fetching data and accepting connections
         3. Sending data back to clients
-        4. Managing session/cookies between clients */
-    template <auto Router, std::size_t MaxClientCount = 4>
+        4. Managing session/cookies between clients
+        @param Router           The router to use for the clients' requests
+        @param MaxClientCount   The maximum number of simultaneous clients
+        @param Pool             The socket pool used for monitoring the sockets (see SelectSocketPool or EPollSocketPool) */
+    template <auto Router, std::size_t MaxClientCount = 4, template <std::size_t> class Pool = SocketPool>
     struct Server
     {
         /** The main client array that's allocated upon construction and never desallocated */
-        Client clientsArray[MaxClientCount] = {};
+        alignas(64) Client clientsArray[MaxClientCount] = {};
+        /** The used clients, 1 bit per client, so a free client is found without touching each client (see findFreeSlot) */
+        uint64 usedSlots[(MaxClientCount + 63) / 64] = {};
+#if UseSeparateRecvBuffers == 1
+        /** The clients' receive buffers, apart from the clients so the clients array stays dense (see UseSeparateRecvBuffers) */
+        alignas(64) uint8 recvBuffers[MaxClientCount][ClientBufferSize];
+#endif
         /** The server's own socket */
         Socket server;
+        /** The position of the first client's socket in the pool (the server's socket is first, followed by the wake up descriptor if any) */
+        static constexpr std::size_t FirstClientPos = UsePostedTasks == 1 || UseRouteOffloading == 1 ? 2 : 1;
         /** The socket pool for passively monitoring sockets */
-        SocketPool<MaxClientCount + 1> pool;
+        Pool<MaxClientCount + FirstClientPos> pool;
+        /** The clients' deadlines (keep alive, headers and content timeouts) */
+        Container::TimerWheel<MaxClientCount> deadlines;
+        /** The time of the current loop, in ms */
+        uint32 now = 0;
+        /** The allowed local peer's user and group identifiers (-1 for any, see ListenOptions) */
+        int peerUid = -1, peerGid = -1;
+        /** The time in microseconds the loop spins on non blocking readiness checks after the last activity, before blocking again (0 to
+            always block). This trades CPU for a lower wake up latency (see also ListenOptions::busyPollUs) */
+        uint32 busyPollIdleUs = 0;
+        /** The time of the last activity, in microseconds (only used when spinning) */
+        uint64 lastActivityUs = 0;
+#if UseOverloadShedding == 1
+        /** The time spent processing the last loop's events, in ms */
+        uint32 loopLag = 0;
+#endif
+#if UseRouteOffloading == 1
+        /** The clients the worker threads are done with, taken back at the beginning of the next loop (a client is queued once at most) */
+        Threading::MPSCQueue<Client *, std::bit_ceil(MaxClientCount)> offloadedClients;
+#endif
+#if UseServerStats == 1
+        /** The server's counters, they can be moved elsewhere (like in shared memory) before the server is started */
+        ServerStats ownStats;
+        ServerStats * stats = &ownStats;
+#endif
+#if UseIdleEviction == 1
+        /** The idle kept alive clients, from the least recently active one */
+        Container::LRUList<MaxClientCount> idleClients;
+        /** The number of idle clients closed to give their slot to a new connection */
+        std::size_t evictedCount = 0;
+#endif
+#if UsePostedTasks == 1
+        /** A task posted to the server by another thread */
+        struct Task
+        {
+            void (*func)(void * arg);
+            void * arg;
+        };
+        /** The tasks posted by the other threads, run at the beginning of the next loop */
+        Threading::MPSCQueue<Task, PostedTaskCount> tasks;
+#endif
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+        /** The descriptor waking the loop up when a task is posted (or a worker thread is done with a client) */
+        WakeUpSocket wakeUp;
+        /** Set when the loop was woken up and cleared once it's processed, so a burst of tasks only wakes it up once */
+        std::atomic<bool> wokenUp = false;
+#endif
+#if UseRouteOffloading == 1
+        /** The worker threads running the offloaded routes' callbacks. Their queues have room for all the clients, so a client is never
+            refused (a worker pushes to offloadedClients and wakes the loop up, so it's stopped before them) */
+        Threading::WorkerPool<OffloadWorkerCount, (MaxClientCount + OffloadWorkerCount - 1) / OffloadWorkerCount> workers;
+#endif
         /** The cookie jar for each session */
         //TODO
 
+        /** What a client is waiting for, once processed */
+        enum class Next
+        {
+            Reading = 0,    //!< The client is waiting for the next request
+            Writing = 1,    //!< The client is waiting for the socket to be writable to continue sending its answer
+            Closing = 2,    //!< The client is closed and should be forgotten
+#if UseRouteOffloading == 1
+            Offloading = 3, //!< The client is about to be owned by a worker thread, its socket must not be monitored until it's taken back
+#endif
+#if UseCoroutineRoutes == 1
+            Sleeping = 4,   //!< The route's coroutine waits for a timer, its socket must not be monitored until it's resumed
+#endif
+#if UseEgressShaping == 1
+            Throttled = 5,  //!< The answer waits for its shapers' tokens, its socket must not be monitored until it's resumed
+#endif
+        };
+
         Error closeClient(Client * client, Code errorCode = Code::Invalid)
         {
             // The client is in error, let's remove it from the pool anyway
@@ -314,94 +535,654 @@ namespace Network::Servers::HTTP
             return Success;
         }
 
-        /** The main server loop */
-        Error loop(uint32 timeoutMs = 20)
+        /** Process the data received from a client's socket (this is independent of the way the data is fetched)
+            @param client   The client that received some data in its receive buffer
+            @param received The result of the receive operation
+            @return what the client is waiting for now */
+        Next processReceived(Client * client, Error received)
         {
-            // Kill any lingering client if any
-            for (auto i = 0; i < MaxClientCount; i++)
+            if (received.isError()) { client->closeWithError(Code::BadRequest); return Next::Closing; }
+            // Check if the client remotely closed meanwhile
+            if (!received.getCount()) { client->closed(); return Next::Closing; }
+            client->recvBuffer.stored(received.getCount());
+#if UseCoroutineRoutes == 1
+            // The route's coroutine was waiting for this data
+            if (client->isSuspended()) return processRoute(client, client->resumeRoute());
+#endif
+
+            // Then parse the client code here at best as we can
+            if (!client->parse()) return closed(client);
+            // Check if we can query the routes now
+            if (client->parsingStatus > Client::RecvHeaders)
+            {   // Yes we can, trigger the router with them
+#if UseServerStats == 1
+                ++stats->requests;
+#endif
+                return processRoute(client, Router.process(*client));
+            }
+            return Next::Reading;
+        }
+
+#if UseNonBlockingSocket == 1
+        /** What a client that's still sending its answer is waiting for */
+        static Next sending(Client * client)
+        {
+#if UseEgressShaping == 1
+            if (client->isThrottled()) return Next::Throttled;
+#endif
+            return Next::Writing;
+        }
+#endif
+
+        /** Find out what the client is waiting for after a route processed it
+            @return what the client is waiting for now */
+        Next processRoute(Client * client, ClientState state)
+        {
+            switch (state)
             {
-                if (clientsArray[i].tickTimeToLive()) pool.remove(clientsArray[i].socket);
+            case ClientState::Error:
+            case ClientState::Done:
+#if UseNonBlockingSocket == 1
+                // The answer isn't completely sent, so wait for the socket to be writable (or the shapers' tokens) to continue
+                if (client->isSending()) return sending(client);
+#endif
+                if (!client->timeToLive) return closed(client);
+            break;
+            // Don't remove the client from the pool in that case, let's simply continue later on
+            case ClientState::Processing: break;
+            case ClientState::NeedRefill: break;
+#if UseRouteOffloading == 1
+            case ClientState::Offloaded: return Next::Offloading;
+#endif
+#if UseCoroutineRoutes == 1
+            case ClientState::Suspended:
+                if (client->awaiting == Client::AwaitingWritable) return Next::Writing;
+                if (client->awaiting == Client::AwaitingTimer) return Next::Sleeping;
+                break;
+#endif
             }
-            if (pool.selectActive(timeoutMs) == Success)
-            {   // At least, one socket made progress, so deal with it
+            return Next::Reading;
+        }
 
-                // Deal with client socket first
-                Socket * socket;
-                while ((socket = pool.getReadableSocket(1))) // Start from 1 since socket 0 if for the server
+#if UseRouteOffloading == 1
+        /** Take back a client once its offloaded route's callback is done
+            @return what the client is waiting for now */
+        Next processOffloaded(Client * client)
+        {
+#if UseNonBlockingSocket == 1
+            if (client->isSending()) return sending(client);
+#endif
+            return client->timeToLive ? Next::Reading : closed(client);
+        }
+#endif
+
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+        /** Continue sending the answer to a client whose socket can accept more data
+            @return what the client is waiting for now */
+        Next processWritable(Client * client)
+        {
+#if UseCoroutineRoutes == 1
+            // The route's coroutine was waiting for the socket to be writable
+            if (client->isSuspended()) return processRoute(client, client->resumeRoute());
+#endif
+#if UseNonBlockingSocket == 1
+            if (!client->resumeSending()) { client->closed(); return Next::Closing; }
+            // Not done yet, wait for the next writable event (or the shapers' tokens)
+            if (client->isSending()) return sending(client);
+#endif
+            // The answer is sent, either close the connection or wait for the next request
+            return client->timeToLive ? Next::Reading : closed(client);
+        }
+#endif
+
+        /** Monitor again a client whose socket was removed from the pool (it was offloaded or sleeping)
+            @return what the client is waiting for now */
+        Next rejoin(Client * client, Next next)
+        {
+            switch (next)
+            {
+            case Next::Reading: break;
+            case Next::Writing: break;
+            case Next::Closing: return next;
+#if UseRouteOffloading == 1
+            case Next::Offloading: offloadClient(client); return next;
+#endif
+#if UseCoroutineRoutes == 1
+            case Next::Sleeping: return next;
+#endif
+#if UseEgressShaping == 1
+            case Next::Throttled: return next;
+#endif
+            }
+            if (!pool.append(client->socket)) return closed(client);
+            if (next == Next::Writing) pool.setInterest(client->socket, false, true);
+            return next;
+        }
+
+        /** Accept a pending client on the server socket
+            @return A pointer to the accepted client or 0 if none is available (or on error, in that case, the error is stored in the given error) */
+        Client * acceptClient(Error & error)
+        {
+            // Find the position for a free client in the array
+            if (const std::size_t i = findFreeSlot(); i < MaxClientCount)
+            {
+                // A refused peer is dropped, and the next pending client is accepted instead
+                do
                 {
-                    // Got a client for a socket, so need to fill the client buffer and let it progress parsing
-                    Client * client = (Client*)(socket); // The address of the first member of a struct is the same as the struct itself //container_of(socket, ClientBase, socket));
+                    error = server.accept(clientsArray[i].socket, 0);
+                    if (error.isError()) return 0;
+                } while (!allowPeer(clientsArray[i].socket));
+                clientsArray[i].accepted();
+                markSlot(i, true);
+                waitFirstRequest((uint32)i);
+#if UseServerStats == 1
+                ++stats->accepted;
+#endif
+                return &clientsArray[i];
+            }
+#if UseIdleEviction == 1
+            // None found, so if a connection is pending, close the least recently active idle client and give its slot to the connection
+            if (idleClients.getSize() && server.select(true, false, 0) == 1 && evictIdleClient()) return acceptClient(error);
+#endif
+            // None found, it'll be processed on the next loop anyway
+            return 0;
+        }
 
-                    // Check if we can fill the receive buffer first
-                    uint32 availableLength = client->recvBuffer.freeSize();
-                    if (!availableLength)
-                    {
-                        closeClient(client, Code::EntityTooLarge);
-                        continue;
-                    }
-                    Error ret = client->socket.recv((char*)client->recvBuffer.getTail(), availableLength);
-                    if (ret.isError())
-                    {
-                        closeClient(client, Code::BadRequest);
-                        continue;
-                    }
-                    // Check if the client remotely closed meanwhile
-                    if (!ret.getCount()) { client->closed(); pool.remove(client->socket); break; }
-                    client->recvBuffer.stored(ret.getCount());
-
-                    // Then parse the client code here at best as we can
-                    if (!client->parse()) closeClient(client);
-                    else {
-                        // Check if we can query the routes now
-                        if (client->parsingStatus > Client::RecvHeaders)
-                        {   // Yes we can, trigger the router with them
-                            switch (Router.process(*client))
-                            {
-                            case ClientState::Error:
-                            case ClientState::Done:
-                                if (!client->timeToLive) { pool.remove(client->socket); }
-                            break;
-                            // Don't remove the client from the pool in that case, let's simply continue later on
-                            case ClientState::Processing: break;
-                            case ClientState::NeedRefill: break;
-                            }
-                        }
-                    }
-                }
+        /** Find a free client's slot with the used slots' bitmap.
+            A slot is marked free each time its client is closed (see updateDeadline), the server being the only one closing the clients
+            (see dropClient), so the bitmap is exact
+            @return The slot's index, or MaxClientCount if none is free */
+        std::size_t findFreeSlot() const
+        {
+            for (std::size_t w = 0; w < ArrSz(usedSlots); w++)
+                if (~usedSlots[w]) return min(w * 64 + (std::size_t)__builtin_ctzll(~usedSlots[w]), MaxClientCount);
+            return MaxClientCount;
+        }
+        /** Mark a client's slot as used or free */
+        void markSlot(const std::size_t index, const bool used)
+        {
+            if (used) usedSlots[index / 64] |= 1ULL << (index & 63);
+            else      usedSlots[index / 64] &= ~(1ULL << (index & 63));
+        }
+        /** Start the deadline of a newly accepted client, its first request is expected soon */
+        void waitFirstRequest(const uint32 index)
+        {
+            deadlines.schedule(index, now + HeaderTimeoutMs);
+#if UseIdleEviction == 1
+            // It isn't idle until its first request is answered
+            idleClients.remove(index);
+#endif
+        }
+        /** Cancel the deadline of a client that's not waiting for anything timed (so it isn't idle either) */
+        void cancelDeadline(const uint32 index)
+        {
+            deadlines.cancel(index);
+#if UseIdleEviction == 1
+            idleClients.remove(index);
+#endif
+        }
 
-                if (pool.isReadable(0))
-                {   // The server socket is active, let's check if we have any client to process
-                    // Find the position for a free client in the array
-                    for (auto i = 0; i < ArrSz(clientsArray); i++)
-                        if (!clientsArray[i].isValid())
-                        {
-                            Error ret = server.accept(clientsArray[i].socket, 0);
-                            if (ret.isError()) return ret;
+#if UseIdleEviction == 1
+        /** Close the least recently active idle client, so its slot can be given to a new connection
+            @return false if no client is idle */
+        bool evictIdleClient()
+        {
+            const uint32 index = idleClients.leastRecent();
+            if (index == idleClients.None) return false;
+            Client * client = &clientsArray[index];
+            SLog(Level::Info, "Client %s: closed while idle for a new connection", client->socket.address);
+            pool.remove(client->socket);
+            client->closed();
+            updateDeadline(client, Next::Closing, false);
+            ++evictedCount;
+            return true;
+        }
+#endif
 
-                            // Client was received, so let's add this to the loop
-                            if (!pool.append(clientsArray[i].socket)) return AllocationFailure;
+        /** Check if an accepted client is allowed (see ListenOptions::peerUid), else close it
+            @return true if the client is allowed */
+        bool allowPeer(Socket & socket)
+        {
+            if (peerUid == -1 && peerGid == -1) return true;
+            int pid = 0, uid = -1, gid = -1;
+            if (socket.getPeerCredentials(pid, uid, gid) && (peerUid == -1 || uid == peerUid) && (peerGid == -1 || gid == peerGid)) return true;
+            SLog(Level::Warning, "Client %s: peer not allowed (uid %d, gid %d)", socket.address, uid, gid);
+            socket.reset();
+            return false;
+        }
 
-                            clientsArray[i].accepted();
-                            break;
-                        }
+#if UsePostedTasks == 1
+        /** Post a task to run in the server's thread at the beginning of its next loop, waking the loop up.
+            This can be called from any thread. The task can use the clients like a route does.
+            @param func     The function to run
+            @param arg      The function's argument
+            @return false if too many tasks are pending (the task isn't run in that case) */
+        bool post(void (*func)(void * arg), void * arg)
+        {
+            if (!tasks.push({ func, arg })) return false;
+            wake();
+            return true;
+        }
+#endif
+        /** Close a client from a posted task (or a route answering another client).
+            The connection is shut down, and the server closes the client (freeing its slot) when it processes the hangup: right away for a
+            client waiting for a request, else once its current operation ends. The client must not be closed directly, since its socket
+            is still monitored (and its slot would leak)
+            @param client   The client to close */
+        void dropClient(Client * client)
+        {
+            if (!client->isValid()) return;
+            client->forceCloseConnection();
+            ::shutdown(client->socket.socket, SHUT_RDWR);
+        }
+#if UseRouteOffloading == 1
+        /** Hand a client to a worker thread, it's queued in offloadedClients once the worker thread is done with it */
+        void offloadClient(Client * client) { client->offload(workers, &offloaded, this); }
+        /** Called by the worker thread that's done with a client */
+        static void offloaded(void * server, Client & client)
+        {
+            // There's room for all the clients, so this can't fail
+            ((Server*)server)->offloadedClients.push(&client);
+            ((Server*)server)->wake();
+        }
+#endif
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+        /** Wake the loop up. This can be called from any thread */
+        void wake() { if (!wokenUp.exchange(true, std::memory_order_acq_rel)) wakeUp.notify(); }
+        /** Check if the loop was woken up, and clear it
+            @return true if the posted tasks (or the clients taken back from the worker threads) must be processed */
+        bool consumeWakeUp()
+        {
+            if (!wokenUp.load(std::memory_order_acquire)) return false;
+            // Consume the notification before accepting new ones, so a task posted while running these wakes the loop up again
+            wakeUp.consume();
+            wokenUp.exchange(false, std::memory_order_acq_rel);
+            return true;
+        }
+#endif
+#if UsePostedTasks == 1
+        /** Run the tasks posted by the other threads */
+        void runPostedTasks()
+        {
+            Task task;
+            while (tasks.pop(task)) task.func(task.arg);
+        }
+#endif
 
-                    // None found, it'll be processed on the next loop anyway
-                    return Success;
+        /** Wait for some activity on the sockets, spinning first if busyPollIdleUs is set
+            @param timeoutMs    The maximum time to wait
+            @return Success if some sockets are active, Timeout else */
+        Error waitActive(const uint32 timeoutMs)
+        {
+            if (busyPollIdleUs)
+            {   // The server was active recently, so check the sockets without blocking until it's idle for too long (or a deadline is due)
+                uint64 start = getMonotonicTimeUs(), time = start;
+                while (time - lastActivityUs < busyPollIdleUs && time - start < (uint64)timeoutMs * 1000)
+                {
+                    if (Error ret = pool.selectActive(0); ret != Timeout) { lastActivityUs = getMonotonicTimeUs(); return ret; }
+                    time = getMonotonicTimeUs();
                 }
             }
+            Error ret = pool.selectActive(timeoutMs);
+            if (busyPollIdleUs && ret == Success) lastActivityUs = getMonotonicTimeUs();
+            return ret;
+        }
 
+#if UseOverloadShedding == 1
+        /** Check if the pending connections must be shed when no client slot is free */
+        bool mustShed() const
+        {
+            if (!ShedBacklogLength) return true;
+            int pending = server.getPendingCount();
+            return pending < 0 || pending > (int)ShedBacklogLength;
+        }
+        /** Accept a pending connection and answer it with the precomputed 503 error, without using any client slot
+            @return Timeout if no connection is pending */
+        Error shedClient()
+        {
+            int descriptor = ::accept(server.socket, nullptr, nullptr);
+            if (descriptor == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? Timeout : Accept;
+            shed(descriptor);
             return Success;
         }
+        /** Answer the given connection with the precomputed 503 error in a single call, and close it (once its request is discarded, so
+            the connection isn't reset before the client reads the answer) */
+        static void shed(int descriptor)
+        {
+  #if UseTLSServer == 0
+            ::send(descriptor, OverloadedAnswer, sizeof(OverloadedAnswer) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+  #endif
+            BaseSocket::discardInput(descriptor);
+            ::close(descriptor);
+        }
+#endif
+
+        /** Update the client's deadline depending on what it's waiting for
+            @param client   The client to update
+            @param next     What the client is waiting for
+            @param started  True if the client was waiting for a new request before the last received data */
+        void updateDeadline(Client * client, const Next next, const bool started)
+        {
+            const uint32 index = (uint32)(client - clientsArray);
+            if (!client->isValid()) markSlot(index, false);
+#if UseIdleEviction == 1
+            // Only a client waiting for its next request (with nothing saved) can be evicted, the least recently active first
+            if (next == Next::Reading && client->isIdle()) idleClients.touch(index);
+            else idleClients.remove(index);
+#endif
+#if UseSharedRecvBuffers == 1
+            // An idle (or closed) client doesn't need its receive buffer anymore, give it back to the pool
+            if (next == Next::Closing || (next == Next::Reading && client->isIdle())) client->releaseBuffer();
+#endif
+#if UseCoroutineRoutes == 1
+            // The route's coroutine is waiting for its timer
+            if (next == Next::Sleeping) return deadlines.schedule(index, now + client->wakeUpDelay);
+#endif
+#if UseEgressShaping == 1
+            // The answer is waiting for its shapers' tokens
+            if (next == Next::Throttled) return deadlines.schedule(index, now + client->throttleDelay);
+#endif
+            // A client that's sending its answer (or owned by a worker thread) isn't idle
+            if (next != Next::Reading) return deadlines.cancel(index);
+            switch (client->parsingStatus)
+            {
+            // Waiting for the next request
+            case Client::Invalid: deadlines.schedule(index, now + KeepAliveTimeoutMs); break;
+            // Receiving the headers, the deadline is counted from the request's first byte
+            case Client::ReqLine:
+            case Client::RecvHeaders:
+            case Client::NeedRefillHeaders:
+                if (started || !deadlines.isScheduled(index)) deadlines.schedule(index, now + HeaderTimeoutMs);
+                break;
+            // Waiting for the content, the deadline is counted from the last progress
+            default: deadlines.schedule(index, now + BodyTimeoutMs); break;
+            }
+        }
 
-        Server() {}
+        /** Process the posted tasks, the clients taken back from the worker threads and the expired deadlines.
+            This is done at the beginning of each loop. A host event loop calls it once the delay given by nextDeadline() elapsed */
+        void onTimer()
+        {
+            processTimers([this](Client * client, const Next next) { updateDeadline(client, rejoin(client, next), false); },
+                          [this](Client * client) { pool.remove(client->socket); return true; });
+        }
+        /** Process the posted tasks, the clients taken back from the worker threads and the expired deadlines, for any engine
+            @param resume   Called with (Client *, Next) for a client that continues (its timer expired or a worker thread is done with it),
+                            so the engine monitors it for what it's waiting for now
+            @param expire   Called with (Client *) for a client whose deadline expired, so the engine stops monitoring it. The client is closed
+                            then, unless it returns false (the engine closes it later on) */
+        template <typename Resume, typename Expire>
+        void processTimers([[maybe_unused]] Resume && resume, Expire && expire)
+        {
+            now = getMonotonicTimeMs();
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            if (consumeWakeUp())
+            {
+  #if UsePostedTasks == 1
+                runPostedTasks();
+  #endif
+  #if UseRouteOffloading == 1
+                // Take back the clients whose offloaded callback is done
+                Client * client;
+                while (offloadedClients.pop(client))
+                    if (client->takeBack()) resume(client, processOffloaded(client));
+  #endif
+            }
+#endif
+            // Kill any lingering client if any
+            deadlines.advance(now, [&](uint32 index) {
+                Client * client = &clientsArray[index];
+                if (!client->isValid()) return;
+#if UseCoroutineRoutes == 1
+                // The route's coroutine is done sleeping
+                if (client->awaiting == Client::AwaitingTimer) return resume(client, processRoute(client, client->resumeRoute()));
+#endif
+#if UseEgressShaping == 1
+                // The answer's shapers have the tokens to continue
+                if (client->isThrottled())
+                {
+                    client->throttleDelay = 0;
+                    return resume(client, processWritable(client));
+                }
+#endif
+#if UseServerStats == 1
+                ++stats->timedOut;
+#endif
+                if (!expire(client)) return;
+                client->closed();
+                updateDeadline(client, Next::Closing, false);
+            });
+        }
+        /** Get the delay until onTimer() must be called, because a client's deadline expires (or the loop was woken up)
+            @param maxDelay     The delay returned if no deadline expires before, in ms
+            @return The delay in ms, 0 if onTimer() must be called now */
+        uint32 nextDeadline(const uint32 maxDelay) const
+        {
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            // The posted tasks and the clients taken back from the worker threads are processed by onTimer() too
+            if (wokenUp.load(std::memory_order_acquire)) return 0;
+#endif
+            return deadlines.nextDelay(getMonotonicTimeMs(), maxDelay);
+        }
 
-        Error create(uint16 port)
+        /** Process a descriptor that's readable, for a server driven by a host event loop (see ExternalSocketPool)
+            @param cookie   The cookie the pool gave with the descriptor the host found readable (or in error): the server's socket, the
+                            wake up descriptor or a client's socket
+            @return Success, or an error if accepting the pending clients failed */
+        Error onReadable(void * cookie)
         {
-            if (Error ret = server.listen(port, MaxClientCount); ret.isError())
+            BaseSocket * socket = (BaseSocket*)cookie;
+            // The socket was removed while processing the previous events
+            if (!pool.contains(*socket)) return Success;
+            now = getMonotonicTimeMs();
+            if (socket == &server) return acceptClients();
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            if (socket == &wakeUp) { onTimer(); return Success; }
+#endif
+            readableClient((Client*)(Socket*)socket); // The address of the first member of a struct is the same as the struct itself
+            return Success;
+        }
+        /** Process a descriptor that's writable, for a server driven by a host event loop (see ExternalSocketPool)
+            @param cookie   The cookie the pool gave with the client's socket the host found writable */
+        void onWritable([[maybe_unused]] void * cookie)
+        {
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+            BaseSocket * socket = (BaseSocket*)cookie;
+            if (!pool.contains(*socket) || socket == &server) return;
+            now = getMonotonicTimeMs();
+            writableClient((Client*)(Socket*)socket);
+#endif
+        }
+
+        /** The main server loop
+            @param timeoutMs    The maximum time to wait for any activity. The server wakes up earlier if a client's deadline expires */
+        Error loop(uint32 timeoutMs = 20)
+        {
+            onTimer();
+            if (waitActive(nextDeadline(timeoutMs)) == Success)
+            {   // At least, one socket made progress, so deal with it
+                now = getMonotonicTimeMs();
+
+                // Deal with client socket first
+                Socket * socket;
+                while ((socket = pool.getReadableSocket(FirstClientPos))) // Socket 0 is for the server
+                    readableClient((Client*)(socket)); // The address of the first member of a struct is the same as the struct itself
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+                // Then continue sending the answers to the clients that can accept more data
+                while ((socket = pool.getWritableSocket(FirstClientPos)))
+                    writableClient((Client*)(socket));
+#endif
+
+#if UseOverloadShedding == 1
+                loopLag = getMonotonicTimeMs() - now;
+#endif
+                // The server socket is active
+                if (pool.isReadable(0)) return acceptClients();
+            }
+
+            return Success;
+        }
+
+        Server()
+        {
+#if UseSeparateRecvBuffers == 1
+            for (std::size_t i = 0; i < MaxClientCount; i++) clientsArray[i].recvBuffer.attach(recvBuffers[i]);
+#endif
+        }
+
+        /** Create the server
+            @param port         The port to listen to
+            @param options      The listening socket's options. If the backlog is 0, the maximum of ListenBacklog and MaxClientCount is used.
+                                If a Unix domain socket path is given, the port is ignored */
+        Error create(uint16 port, ListenOptions options)
+        {
+            if (!options.backlog) options.backlog = (int)max(MaxClientCount, (std::size_t)ListenBacklog);
+            if (Error ret = server.listen(port, options); ret.isError())
                 return ret;
+            peerUid = options.peerUid; peerGid = options.peerGid;
 
+            now = getMonotonicTimeMs();
+            deadlines.init(now);
             if (!pool.append(server)) return AllocationFailure;
-            SLog(Level::Info, "HTTP server listening on port %u", (unsigned)port);
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            // The wake up descriptor follows the server's socket in the pool
+            if (Error ret = wakeUp.open(); ret.isError()) return ret;
+            if (!pool.append(wakeUp)) return AllocationFailure;
+#endif
+            if (options.unixPath) SLog(Level::Info, "HTTP server listening on %s", options.unixPath);
+            else SLog(Level::Info, "HTTP server listening on port %u", (unsigned)port);
+            return Success;
+        }
+        /** Create the server with the default options
+            @param port         The port to listen to
+            @param sharePort    If true, the port can be shared with other servers and the system balances the incoming connections between them */
+        Error create(uint16 port, const bool sharePort = false)
+        {
+            ListenOptions options;
+            options.sharePort = sharePort;
+            return create(port, options);
+        }
+
+    private:
+        /** Make sure a client that's done is closed */
+        static Next closed(Client * client)
+        {
+            if (client->isValid()) client->closed();
+            return Next::Closing;
+        }
+
+        /** Receive and process the data for a client whose socket is readable */
+        void readableClient(Client * client)
+        {
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+            // A client that's still sending its answer is only reported here upon error or hangup
+            if (client->isWaitingToSend())
+            {
+                Next next = processWritable(client);
+                switch (next)
+                {
+                case Next::Reading: pool.setInterest(client->socket, true, false); break;
+                case Next::Writing: break;
+                default: pool.remove(client->socket); next = rejoin(client, next); break;
+                }
+                return updateDeadline(client, next, false);
+            }
+#endif
+
+#if UseSharedRecvBuffers == 1
+            // The client only gets a receive buffer when it has something to receive
+            if (!client->attachBuffer())
+            {
+                SLog(Level::Warning, "Client %s: no receive buffer available", client->socket.address);
+                pool.remove(client->socket);
+                client->socket.send(UnavailableAnswer, sizeof(UnavailableAnswer) - 1);
+                // Don't let the unread request reset the connection before the answer is read
+                client->socket.discardInput();
+                client->closed();
+                return updateDeadline(client, Next::Closing, false);
+            }
+#endif
+            // Check if we can fill the receive buffer first
+            uint32 availableLength = client->receivableSize();
+            if (!availableLength)
+            {
+                closeClient(client, Code::EntityTooLarge);
+                return updateDeadline(client, Next::Closing, false);
+            }
+            const bool started = client->parsingStatus == Client::Invalid;
+            Next next = processReceived(client, client->socket.recv((char*)client->recvBuffer.getTail(), availableLength));
+            switch (next)
+            {
+            case Next::Reading: break;
+            case Next::Writing: pool.setInterest(client->socket, false, true); break;
+            case Next::Closing: pool.remove(client->socket); break;
+#if UseRouteOffloading == 1
+            case Next::Offloading: pool.remove(client->socket); offloadClient(client); break;
+#endif
+#if UseCoroutineRoutes == 1
+            case Next::Sleeping: pool.remove(client->socket); break;
+#endif
+#if UseEgressShaping == 1
+            case Next::Throttled: pool.remove(client->socket); break;
+#endif
+            }
+            updateDeadline(client, next, started);
+        }
+
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+        /** Continue sending the answer of a client whose socket is writable */
+        void writableClient(Client * client)
+        {
+            Next next = processWritable(client);
+            switch (next)
+            {
+            case Next::Reading: pool.setInterest(client->socket, true, false); break;
+            case Next::Writing: break;
+            case Next::Closing: pool.remove(client->socket); break;
+#if UseRouteOffloading == 1
+            case Next::Offloading: break; // Can't happen
+#endif
+#if UseCoroutineRoutes == 1
+            case Next::Sleeping: pool.remove(client->socket); break;
+#endif
+#if UseEgressShaping == 1
+            case Next::Throttled: pool.remove(client->socket); break;
+#endif
+            }
+            updateDeadline(client, next, false);
+        }
+#endif
+
+        /** Accept the pending clients (up to AcceptBatchSize) so a burst doesn't wait in the backlog */
+        Error acceptClients()
+        {
+#if UseOverloadShedding == 1
+            // When lagging, the new connections are shed so the server catches up with its current clients
+            const bool lagging = ShedLoopLagMs && loopLag > ShedLoopLagMs;
+#endif
+            for (std::size_t i = 0; i < AcceptBatchSize; i++)
+            {
+                Error ret = Success;
+#if UseOverloadShedding == 1
+                Client * client = lagging ? 0 : acceptClient(ret);
+#else
+                Client * client = acceptClient(ret);
+#endif
+                // No more pending client
+                if (ret == Timeout) break;
+                if (ret.isError()) return ret;
+                if (!client)
+                {
+#if UseOverloadShedding == 1
+                    // Answer with a 503 error right away instead of leaving the client in the backlog until it times out
+                    if ((lagging || mustShed()) && shedClient() != Timeout) continue;
+#endif
+                    // No free slot, the remaining clients wait in the backlog
+                    break;
+                }
+                // Client was received, so let's add this to the loop
+                if (!pool.append(client->socket)) return AllocationFailure;
+            }
             return Success;
         }
     };
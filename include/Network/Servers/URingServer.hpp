@@ -0,0 +1,393 @@
+#ifndef hpp_URingServer_hpp
+#define hpp_URingServer_hpp
+
+// We need the server and routes declaration
+#include "Route.hpp"
+// We need io_uring
+#include "Network/IOURing.hpp"
+#include <poll.h>
+
+#if UseTLSServer == 1
+  #error "The io_uring engine doesn't support TLS server"
+#endif
+
+namespace Network::Servers::HTTP
+{
+    /** An alternative engine for the server using io_uring (Linux only).
+        Instead of waiting for the sockets readiness and then calling the system for each operation, the operations are submitted in batch to
+        the kernel and their completions drive the same client state machine as the Server (so routes behave exactly the same).
+        A single multishot accept request is used for the server socket and each client always has a pending receive request that's writing
+        directly in its receive buffer (no copy, and no additional memory). The answers are sent by the routes as usual.
+        If UseSharedRecvBuffers is 1, an idle client has a pending poll request instead, and takes a receive buffer once its socket is readable.
+
+        The operation's user data is made of the operation kind, the client's index and the client's slot generation, so completions for a slot
+        that was recycled meanwhile are ignored. */
+    template <auto Router, std::size_t MaxClientCount = 4>
+    struct URingServer : public Server<Router, MaxClientCount>
+    {
+        typedef Server<Router, MaxClientCount> Base;
+        typedef typename Base::Next Next;
+
+        /** The ring used for submitting the operations */
+        IOURing     ring;
+        /** The generation for each client slot, increased each time the slot's pending operations are to be forgotten */
+        uint32      generation[MaxClientCount] = {};
+#if UseIdleEviction == 1 && UseSharedRecvBuffers == 0
+        /** The connection waiting for each slot whose idle client is evicted, it gets the slot once the client's pending receive completes
+            (-1 for none) */
+        int         successors[MaxClientCount];
+#endif
+
+        /** Process the posted tasks, the clients taken back from the worker threads and the expired deadlines, like the Server does, but the
+            operations the clients are waiting for are submitted to the ring (and the expired clients' pending operations are cancelled) */
+        void onTimer()
+        {
+            this->processTimers([this](Client * client, const Next next) { arm((std::size_t)(client - this->clientsArray), next); },
+                                [this](Client * client)
+            {
+#if UseSharedRecvBuffers == 1
+                // An idle client has no buffer, only its readiness poll is pending
+                if (!client->recvBuffer.isAttached()) { cancel((std::size_t)(client - this->clientsArray), Polling); return true; }
+#endif
+                // The kernel owns the receive buffer until the pending receive completes (even if it's cancelled, it can be running), so
+                // end it instead (it completes without data and the client is closed then, before its slot is reused)
+                ::shutdown(client->socket.socket, SHUT_RDWR);
+                return false;
+            });
+        }
+
+        /** The main server loop
+            @param timeoutMs    The maximum time to wait for any completion. The server wakes up earlier if a client's deadline expires */
+        Error loop(uint32 timeoutMs = 20)
+        {
+            onTimer();
+            // Submit all the pending operations and wait for completions in a single call
+            Error ret = waitCompletion(this->nextDeadline(timeoutMs));
+            if (ret.isError()) return ret == Timeout ? Error(Success) : ret;
+            this->now = getMonotonicTimeMs();
+
+            Error error = Success;
+            ring.forEachCompletion([&](const io_uring_cqe & cqe) { if (Error ret = complete(cqe); ret.isError()) error = ret; });
+#if UseOverloadShedding == 1
+            this->loopLag = getMonotonicTimeMs() - this->now;
+#endif
+            return error;
+        }
+
+        /** Create the server
+            @param port         The port to listen to
+            @param options      The listening socket's options. If the backlog is 0, the maximum of ListenBacklog and MaxClientCount is used.
+                                If a Unix domain socket path is given, the port is ignored */
+        Error create(uint16 port, ListenOptions options)
+        {
+            if (Error ret = ring.init((uint32)min(MaxClientCount + 2 + (UsePostedTasks == 1 || UseRouteOffloading == 1), (std::size_t)1024)); ret.isError())
+                return ret;
+            if (!options.backlog) options.backlog = (int)max(MaxClientCount, (std::size_t)ListenBacklog);
+            if (Error ret = this->server.listen(port, options); ret.isError())
+                return ret;
+            this->peerUid = options.peerUid; this->peerGid = options.peerGid;
+
+            this->now = getMonotonicTimeMs();
+            this->deadlines.init(this->now);
+#if UseIdleEviction == 1 && UseSharedRecvBuffers == 0
+            for (int & descriptor : successors) descriptor = -1;
+#endif
+            if (!armAccept()) return AllocationFailure;
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            if (Error ret = this->wakeUp.open(); ret.isError()) return ret;
+            if (!armWakeUp()) return AllocationFailure;
+#endif
+            if (options.unixPath) SLog(Level::Info, "HTTP server listening on %s (io_uring)", options.unixPath);
+            else SLog(Level::Info, "HTTP server listening on port %u (io_uring)", (unsigned)port);
+            return Success;
+        }
+        /** Create the server with the default options
+            @param port         The port to listen to
+            @param sharePort    If true, the port can be shared with other servers and the system balances the incoming connections between them */
+        Error create(uint16 port, const bool sharePort = false)
+        {
+            ListenOptions options;
+            options.sharePort = sharePort;
+            return create(port, options);
+        }
+
+    private:
+        /** Submit the pending operations and wait for any completion, spinning first if busyPollIdleUs is set (like the Server)
+            @param timeoutMs    The maximum time to wait
+            @return Success if any completion is available, Timeout else */
+        Error waitCompletion(const uint32 timeoutMs)
+        {
+            if (this->busyPollIdleUs)
+            {   // Submitting without waiting also lets the kernel post the pending completions
+                uint64 start = getMonotonicTimeUs(), time = start;
+                while (time - this->lastActivityUs < this->busyPollIdleUs && time - start < (uint64)timeoutMs * 1000)
+                {
+                    if (Error ret = ring.submitAndWait(0, 0); ret.isError()) return ret;
+                    if (ring.hasCompletion()) { this->lastActivityUs = getMonotonicTimeUs(); return Success; }
+                    time = getMonotonicTimeUs();
+                }
+            }
+            Error ret = ring.submitAndWait(1, timeoutMs);
+            if (this->busyPollIdleUs && ret == Success) this->lastActivityUs = getMonotonicTimeUs();
+            return ret;
+        }
+
+        /** The kind of operations submitted to the ring */
+        enum Operation : uint8
+        {
+            Accepting = 0,
+            Receiving = 1,
+            Writing   = 2,
+            Cancelling= 3,
+#if UseSharedRecvBuffers == 1
+            Polling   = 4,  //!< Waiting for an idle client's socket to be readable
+#endif
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            WakingUp  = 5,  //!< Waiting for a task to be posted (or a worker thread to be done with a client)
+#endif
+        };
+
+        uint64 userData(Operation op, std::size_t index) const { return ((uint64)op << 56) | ((uint64)(generation[index] & 0xFFFFFF) << 32) | (uint64)index; }
+
+        /** Deal with a completed operation */
+        Error complete(const io_uring_cqe & cqe)
+        {
+            Operation op = (Operation)(cqe.user_data >> 56);
+            std::size_t index = (std::size_t)(cqe.user_data & 0xFFFFFFFF);
+            switch (op)
+            {
+            case Accepting:
+            {
+                Error ret = cqe.res >= 0 ? accepted(cqe.res) : Error(Accept);
+                // The multishot accept can stop (for example, upon error), so re-arm it then
+                if (!(cqe.flags & IORING_CQE_F_MORE) && !armAccept()) return AllocationFailure;
+                return ret;
+            }
+            case Cancelling: return Success;
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+            // The tasks are run on the next loop, the multishot poll can stop too
+            case WakingUp: return (cqe.flags & IORING_CQE_F_MORE) || armWakeUp() ? Error(Success) : Error(AllocationFailure);
+#endif
+            case Receiving:
+            case Writing:
+            {
+                // Ignore completion for a previous client in this slot
+                if (index >= MaxClientCount || userData(op, index) != cqe.user_data) return Success;
+                Client * client = &this->clientsArray[index];
+#if UseNonBlockingSocket == 1 || UseCoroutineRoutes == 1
+                if (op == Writing) { arm(index, this->processWritable(client)); return Success; }
+#endif
+                const bool started = client->parsingStatus == Client::Invalid;
+                arm(index, this->processReceived(client, Error(cqe.res >= 0 ? cqe.res : -(int)Network::Receiving)), started);
+                return Success;
+            }
+#if UseSharedRecvBuffers == 1
+            case Polling:
+            {
+                if (index >= MaxClientCount || userData(op, index) != cqe.user_data) return Success;
+                Client * client = &this->clientsArray[index];
+                // The idle client has something to receive, so it needs a receive buffer now
+                if (!client->attachBuffer())
+                {
+                    SLog(Level::Warning, "Client %s: no receive buffer available", client->socket.address);
+                    client->socket.send(UnavailableAnswer, sizeof(UnavailableAnswer) - 1);
+                    // Don't let the unread request reset the connection before the answer is read
+                    client->socket.discardInput();
+                    client->closed();
+                    arm(index, Next::Closing);
+                    return Success;
+                }
+                // The socket is readable, so this doesn't block
+                arm(index, this->processReceived(client, client->socket.recv((char*)client->recvBuffer.getTail(), client->receivableSize())), true);
+                return Success;
+            }
+#endif
+            }
+            return Success;
+        }
+
+        /** A client was accepted by the kernel, find a slot for it */
+        Error accepted(int descriptor)
+        {
+#if UseOverloadShedding == 1
+            // The server is lagging, so let it catch up with its current clients
+            if (ShedLoopLagMs && this->loopLag > ShedLoopLagMs) { Base::shed(descriptor); return Success; }
+#endif
+            if (const std::size_t i = this->findFreeSlot(); i < MaxClientCount)
+            {
+                if (Error ret = this->clientsArray[i].socket.adopt(descriptor); ret.isError())
+                {
+                    this->clientsArray[i].socket.reset();
+                    return ret;
+                }
+                if (!this->allowPeer(this->clientsArray[i].socket)) return Success;
+                this->clientsArray[i].accepted();
+                this->markSlot(i, true);
+                arm(i, Next::Reading);
+                // The first request is expected soon
+                if (this->clientsArray[i].isValid()) this->waitFirstRequest((uint32)i);
+#if UseServerStats == 1
+                ++this->stats->accepted;
+#endif
+                return Success;
+            }
+#if UseIdleEviction == 1
+            // No slot available, so close the least recently active idle client and give its slot to this client
+            if (const uint32 index = this->idleClients.leastRecent(); index != this->idleClients.None)
+            {
+                Client & client = this->clientsArray[index];
+                SLog(Level::Info, "Client %s: closed while idle for a new connection", client.socket.address);
+                ++this->evictedCount;
+  #if UseSharedRecvBuffers == 1
+                // An idle client has no receive buffer, only its readiness poll is pending
+                cancel(index, Polling);
+                client.closed();
+                this->updateDeadline(&client, Next::Closing, false);
+                return accepted(descriptor);
+  #else
+                // The kernel owns the client's receive buffer until its pending receive completes, so end it and give the slot to this
+                // connection once it's completed (see arm)
+                client.forceCloseConnection();
+                ::shutdown(client.socket.socket, SHUT_RDWR);
+                this->cancelDeadline(index);
+                successors[index] = descriptor;
+                return Success;
+  #endif
+            }
+#endif
+            // No slot available for this client, so we can't serve it
+#if UseOverloadShedding == 1
+            Base::shed(descriptor);
+#else
+            ::close(descriptor);
+#endif
+            return Success;
+        }
+
+        /** Submit the operation the client is waiting for (and update its deadline)
+            @param started  True if the client was waiting for a new request before the last received data */
+        void arm(std::size_t index, Next next, const bool started = false)
+        {
+            Client & client = this->clientsArray[index];
+            io_uring_sqe * sqe = 0;
+            switch (next)
+            {
+            case Next::Reading:
+            {
+#if UseSharedRecvBuffers == 1
+                // An idle client gives back its receive buffer and only waits for the socket to be readable
+                if (client.isIdle()) client.releaseBuffer();
+                if (!client.recvBuffer.isAttached())
+                {
+                    if (!(sqe = ring.getEntry())) { client.closed(); break; }
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->fd = client.socket.socket;
+                    sqe->poll32_events = POLLIN;
+                    sqe->user_data = userData(Polling, index);
+                    this->updateDeadline(&client, next, started);
+                    return;
+                }
+#endif
+                uint32 availableLength = client.receivableSize();
+                if (!availableLength) { client.closeWithError(Code::EntityTooLarge); break; }
+                if (!(sqe = ring.getEntry())) { client.closed(); break; }
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = client.socket.socket;
+                sqe->addr = (uint64)(uintptr_t)client.recvBuffer.getTail();
+                sqe->len = availableLength;
+                sqe->user_data = userData(Receiving, index);
+                this->updateDeadline(&client, next, started);
+                return;
+            }
+            case Next::Writing:
+                if (!(sqe = ring.getEntry())) { client.closed(); break; }
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = client.socket.socket;
+                sqe->poll32_events = POLLOUT;
+                sqe->user_data = userData(Writing, index);
+                this->cancelDeadline((uint32)index);
+                return;
+            case Next::Closing: break;
+#if UseRouteOffloading == 1
+            case Next::Offloading:
+                // Nothing is pending for this client until it's taken back
+                this->cancelDeadline((uint32)index);
+                this->offloadClient(&client);
+                return;
+#endif
+#if UseCoroutineRoutes == 1
+            case Next::Sleeping:
+                // Nothing is pending for this client until its timer expires
+                this->updateDeadline(&client, next, false);
+                return;
+#endif
+#if UseEgressShaping == 1
+            case Next::Throttled:
+                // Nothing is pending for this client until its shapers have the tokens
+                this->updateDeadline(&client, next, false);
+                return;
+#endif
+            }
+            // Nothing pending for this slot anymore
+            this->cancelDeadline((uint32)index);
+            if (!client.isValid()) this->markSlot(index, false);
+#if UseSharedRecvBuffers == 1
+            client.releaseBuffer();
+#endif
+            ++generation[index];
+#if UseIdleEviction == 1 && UseSharedRecvBuffers == 0
+            // A connection is waiting for this evicted client's slot
+            if (const int descriptor = successors[index]; descriptor != -1)
+            {
+                successors[index] = -1;
+                accepted(descriptor);
+            }
+#endif
+        }
+
+#if UseSharedRecvBuffers == 1
+        /** Cancel the pending poll operation for the given client (it was closed meanwhile).
+            A pending receive isn't cancelled this way since it could still write in the receive buffer once the slot is reused */
+        void cancel(std::size_t index, Operation op)
+        {
+            uint64 data = userData(op, index);
+            ++generation[index];
+            if (io_uring_sqe * sqe = ring.getEntry())
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = data;
+                sqe->user_data = userData(Cancelling, index);
+            }
+        }
+#endif
+
+        /** Submit the (multishot) accept operation on the server socket */
+        bool armAccept()
+        {
+            io_uring_sqe * sqe = ring.getEntry();
+            if (!sqe) return false;
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = this->server.socket;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC | (UseNonBlockingSocket == 1 ? SOCK_NONBLOCK : 0);
+            sqe->user_data = ((uint64)Accepting << 56);
+            return true;
+        }
+#if UsePostedTasks == 1 || UseRouteOffloading == 1
+        /** Submit the (multishot) poll operation on the wake up descriptor */
+        bool armWakeUp()
+        {
+            io_uring_sqe * sqe = ring.getEntry();
+            if (!sqe) return false;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = this->wakeUp.socket;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = ((uint64)WakingUp << 56);
+            return true;
+        }
+#endif
+    };
+}
+
+#endif
@@ -12,15 +12,44 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/types.h>
+#if defined(__linux__)
+  // We need epoll for the socket pool
+  #include <sys/epoll.h>
+  // We need eventfd for waking up a pool
+  #include <sys/eventfd.h>
+  // We need sendfile for sending a file without copying it
+  #include <sys/sendfile.h>
+  #if UseZeroCopySend == 1
+    // We need the zero copy notifications and poll for waiting for them
+    #include <linux/errqueue.h>
+    #include <poll.h>
+  #endif
+#elif UseZeroCopySend == 1
+  #error "Zero copy sending is only supported on Linux"
+#endif
 #include <unistd.h>
-// We need TCP_NODELAY
+// We need clock_gettime
+#include <time.h>
+// We need TCP_NODELAY, TCP_DEFER_ACCEPT and TCP_FASTOPEN
 #include <netinet/tcp.h>
 // We need sockaddr_in
 #include <netinet/in.h>
+// We need sockaddr_un for Unix domain sockets
+#include <sys/un.h>
+// We need iovec for sending the gathered data along with a buffer
+#include <sys/uio.h>
+#include <stddef.h>
+// We need fcntl and errno for non blocking sockets (the listening socket is always non blocking)
+#include <fcntl.h>
+#include <errno.h>
 #if BuildClient == 1
-  #include <fcntl.h>
   #include <netdb.h>
 #endif
+#if UseNonBlockingSocket == 1
+  #if UseTLSServer == 1
+    #error "Non blocking sockets aren't supported for TLS server"
+  #endif
+#endif
 
 #if UseTLS == 1
 // We need MBedTLS code
@@ -49,28 +78,119 @@ namespace Network {
 
     #define closesocket         close
 
+#if UseNonBlockingSocket == 1 || UseZeroCopySend == 1
+  #ifndef NonBlockingTimeout
+    /** The maximum time in milliseconds to wait for a non blocking socket to be ready when a blocking call is emulated
+        (or for the system to be done with the zero copy sends) */
+    #define NonBlockingTimeout  3000
+  #endif
+  #ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL        0
+  #endif
+#endif
+
     static struct timeval timeoutFromMs(const uint32 timeout)
     {
         return timeval { (time_t)(timeout / 1024), // Avoid division here (compiler should shift the value here), the value is approximative anyway
                          (suseconds_t)((timeout & 1023) * 977)};  // Avoid modulo here and make sure it doesn't overflow (since 1023 * 977 < 1000000)
     }
 
+    /** Get a monotonic time in milliseconds. This wraps around every 49 days, so only compare differences */
+    inline uint32 getMonotonicTimeMs()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint32)((uint64)t.tv_sec * 1000 + (uint64)t.tv_nsec / 1000000);
+    }
+    /** Get a monotonic time in microseconds */
+    inline uint64 getMonotonicTimeUs()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64)t.tv_sec * 1000000 + (uint64)t.tv_nsec / 1000;
+    }
+
+    /** The options for a listening socket.
+        An option that's 0 (or false) isn't set, so the system's default is used */
+    struct ListenOptions
+    {
+        /** The listening backlog (for a server, 0 means the maximum of ListenBacklog and its maximum number of clients) */
+        int     backlog = 0;
+        /** Disable Nagle's algorithm on the accepted sockets (TCP_NODELAY). If an answer is sent in multiple parts (like a chunked answer),
+            with Nagle's algorithm, a part can wait for the client's delayed acknowledgement of the previous one */
+        bool    noDelay = false;
+        /** Only report a connection once the client has sent some data, waiting up to this time in seconds (TCP_DEFER_ACCEPT, Linux only).
+            The server isn't woken up for connections that don't send anything yet */
+        int     deferAcceptSec = 0;
+        /** The maximum number of pending TCP Fast Open connections (TCP_FASTOPEN), so a returning client can send its request in the SYN packet.
+            The system must allow it too (on Linux, net.ipv4.tcp_fastopen must have the server bit) */
+        int     fastOpenQueue = 0;
+        /** The receive and send buffer sizes of the accepted sockets in bytes (SO_RCVBUF and SO_SNDBUF) */
+        int     receiveBufferSize = 0;
+        int     sendBufferSize = 0;
+        /** If true, other sockets (with the same option) can listen on the same port and the system spreads the incoming connections between
+            them (SO_REUSEPORT) */
+        bool    sharePort = false;
+        /** The time in microseconds the system busy polls the network device for a blocking receive on the accepted sockets (SO_BUSY_POLL,
+            Linux only). Raising it above net.core.busy_read requires the CAP_NET_ADMIN capability */
+        int     busyPollUs = 0;
+        /** If set, listen on this Unix domain socket path instead of a TCP port (for a reverse proxy on the same host).
+            A path starting with '@' is in the abstract namespace (Linux only), else any existing file at this path is removed first.
+            The TCP options and sharePort can't be used then */
+        const char * unixPath = nullptr;
+        /** Only accept the local peers running with this user and group identifiers (checked with SO_PEERCRED on a Unix domain socket),
+            -1 to accept any */
+        int     peerUid = -1;
+        int     peerGid = -1;
+        /** If set, use this already listening socket instead of creating one (like a socket inherited from a parent process, see
+            PreforkServer). The other socket's options are ignored then */
+        int     listenDescriptor = -1;
+    };
+
     /** The base socket that's used in the server, using plain old IPv4 and no specific code */
     struct BaseSocket
     {
         int                      socket;
+        /** The socket's position in the socket pool monitoring it (it's maintained by the pool, so it finds the socket without searching) */
+        uint32                   poolPos = 0;
         char                     address[IPV4StrAddressLen];
 
         /** Start listening on the socket
-            @return 0 on success, negative value upon error */
-        Virtual Error listen(uint16 port, int maxClientCount = 1)
+            @param port             The port to listen to
+            @param options          The socket's options (see ListenOptions). The accepted sockets inherit the TCP_NODELAY and buffer sizes options
+            @return 0 on success, negative value upon error (SocketOption if an option isn't supported on this system)
+            @warning The listening socket is non blocking, so the pending connections can be accepted in a batch until none is left */
+        Virtual Error listen(uint16 port, const ListenOptions & options)
         {
+            if (options.listenDescriptor != -1) { socket = options.listenDescriptor; return Success; }
+            if (options.unixPath) return listenLocal(options);
             socket = ::socket(AF_INET, SOCK_STREAM, 0);
             if (socket == -1) return SocketCreation;
 
             // Make sure we can bind on an already bound address
             int n = 1;
             if (::setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char *) &n, sizeof(n)) != 0) return SocketOption;
+            // Let other sockets listen on the same port if asked to
+#ifdef SO_REUSEPORT
+            if (options.sharePort && ::setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (const char *) &n, sizeof(n)) != 0) return SocketOption;
+#else
+            if (options.sharePort) return SocketOption;
+#endif
+            if (options.noDelay && ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &n, sizeof(n)) != 0) return SocketOption;
+            // The buffer sizes must be set before listening, since the TCP window scale is negotiated in the handshake
+            if (options.receiveBufferSize && ::setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &options.receiveBufferSize, sizeof(options.receiveBufferSize)) != 0) return SocketOption;
+            if (options.sendBufferSize && ::setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &options.sendBufferSize, sizeof(options.sendBufferSize)) != 0) return SocketOption;
+#ifdef SO_BUSY_POLL
+            if (options.busyPollUs && ::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &options.busyPollUs, sizeof(options.busyPollUs)) != 0) return SocketOption;
+#else
+            if (options.busyPollUs) return SocketOption;
+#endif
+#ifdef TCP_DEFER_ACCEPT
+            if (options.deferAcceptSec && ::setsockopt(socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.deferAcceptSec, sizeof(options.deferAcceptSec)) != 0) return SocketOption;
+#else
+            if (options.deferAcceptSec) return SocketOption;
+#endif
+            if (::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL, 0) | O_NONBLOCK) != 0) return SocketOption;
 
             struct sockaddr_in address;
             address.sin_port = htons(port);
@@ -78,10 +198,51 @@ namespace Network {
             address.sin_addr.s_addr = htonl(INADDR_ANY);
 
             if (int ret = ::bind(socket, (const sockaddr*)&address, sizeof(address)); ret < 0) return Bind;
-            if (int ret = ::listen(socket, maxClientCount); ret < 0) return Listen;
+#ifdef TCP_FASTOPEN
+            if (options.fastOpenQueue && ::setsockopt(socket, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpenQueue, sizeof(options.fastOpenQueue)) != 0) return SocketOption;
+#else
+            if (options.fastOpenQueue) return SocketOption;
+#endif
+            if (int ret = ::listen(socket, options.backlog > 0 ? options.backlog : 1); ret < 0) return Listen;
 
             return Success;
         }
+        /** Start listening on a Unix domain socket (see ListenOptions::unixPath) */
+        Error listenLocal(const ListenOptions & options)
+        {
+            if (options.sharePort || options.deferAcceptSec || options.fastOpenQueue) return SocketOption;
+            struct sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            std::size_t length = strlen(options.unixPath);
+            if (length >= sizeof(address.sun_path)) return Bind;
+            memcpy(address.sun_path, options.unixPath, length);
+            // The abstract namespace starts with a zero byte and isn't zero terminated, else remove any stale socket file
+            if (address.sun_path[0] == '@') address.sun_path[0] = 0;
+            else ::unlink(address.sun_path);
+
+            socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (socket == -1) return SocketCreation;
+            if (options.receiveBufferSize && ::setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &options.receiveBufferSize, sizeof(options.receiveBufferSize)) != 0) return SocketOption;
+            if (options.sendBufferSize && ::setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &options.sendBufferSize, sizeof(options.sendBufferSize)) != 0) return SocketOption;
+            if (::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL, 0) | O_NONBLOCK) != 0) return SocketOption;
+
+            if (int ret = ::bind(socket, (const sockaddr*)&address, (socklen_t)(offsetof(sockaddr_un, sun_path) + length + (address.sun_path[0] ? 1 : 0))); ret < 0) return Bind;
+            if (int ret = ::listen(socket, options.backlog > 0 ? options.backlog : 1); ret < 0) return Listen;
+            return Success;
+        }
+        /** Start listening on the socket
+            @param port             The port to listen to
+            @param maxClientCount   The listening backlog
+            @param sharePort        If true, other sockets (with the same option) can listen on the same port and the system spreads the
+                                    incoming connections between them (SO_REUSEPORT)
+            @return 0 on success, negative value upon error */
+        Error listen(uint16 port, int maxClientCount = 1, const bool sharePort = false)
+        {
+            ListenOptions options;
+            options.backlog = maxClientCount;
+            options.sharePort = sharePort;
+            return listen(port, options);
+        }
 
 #if BuildClient == 1
         /** Connect to a given URI */
@@ -146,7 +307,7 @@ namespace Network {
 
 
         /** Accept a new client.
-            @return 0 on success, negative value upon error */
+            @return 0 on success, Timeout if no client is pending, negative value upon error */
         Virtual Error accept(BaseSocket & clientSocket, const uint32 timeoutMillis = 0)
         {
             // Check for activity on the socket
@@ -154,18 +315,96 @@ namespace Network {
                 if (Error ret = select(true, false, timeoutMillis); ret.isError()) return ret;
             }
 
-            struct sockaddr_in clientAddress = {};
+            struct sockaddr_storage clientAddress = {};
             socklen_t addrLen = sizeof(clientAddress);
+#if defined(__linux__)
+            // Set the client's socket flags in the same system call
+            int ret = ::accept4(socket, (sockaddr*)&clientAddress, &addrLen, SOCK_CLOEXEC | (UseNonBlockingSocket == 1 ? SOCK_NONBLOCK : 0));
+            if (ret == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? Timeout : Accept;
+  #if UseZeroCopySend == 1
+            clientSocket.enableZeroCopy(ret);
+  #endif
+#else
             int ret = ::accept(socket, (sockaddr*)&clientAddress, &addrLen);
-            if (ret == -1) return Accept;
+            if (ret == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? Timeout : Accept;
+            // The accepted socket doesn't inherit TCP_NODELAY on every system, so copy it from the listening socket
+            int noDelay = 0; socklen_t len = sizeof(noDelay);
+            if (::getsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, &len) == 0 && noDelay) ::setsockopt(ret, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  #if UseNonBlockingSocket == 1
+            // Client sockets are non blocking so the server never waits on a slow client
+            if (::fcntl(ret, F_SETFL, ::fcntl(ret, F_GETFL, 0) | O_NONBLOCK) != 0) { ::closesocket(ret); return SocketOption; }
+  #else
+            // The accepted socket might inherit the listening socket's non blocking flag on some systems
+            if (::fcntl(ret, F_SETFL, ::fcntl(ret, F_GETFL, 0) & ~O_NONBLOCK) != 0) { ::closesocket(ret); return SocketOption; }
+  #endif
+#endif
 
             clientSocket.socket = ret;
-            sprintf(clientSocket.address, "%u.%u.%u.%u:%u", (unsigned)((clientAddress.sin_addr.s_addr >> 0) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 8) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 16) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 24) & 0xFF), (unsigned)clientAddress.sin_port);
+            clientSocket.setAddress(clientAddress);
             return Success;
         }
 
+        /** Take ownership of an already accepted socket descriptor (this is used by the completion based engines that accept on their own) */
+        Error adopt(int descriptor)
+        {
+            struct sockaddr_storage clientAddress = {};
+            socklen_t addrLen = sizeof(clientAddress);
+            socket = descriptor;
+            if (::getpeername(socket, (sockaddr*)&clientAddress, &addrLen) != 0) return SocketOption;
+            setAddress(clientAddress);
+#if UseZeroCopySend == 1
+            enableZeroCopy(socket);
+#endif
+            return Success;
+        }
+
+        /** Get the number of connections waiting to be accepted on this listening socket (only for TCP on Linux)
+            @return -1 if it's unknown */
+        int getPendingCount() const
+        {
+#if defined(__linux__) && defined(TCP_INFO)
+            // For a listening socket, the kernel reports the accept queue's length as the unacknowledged count
+            struct tcp_info info;
+            socklen_t length = sizeof(info);
+            if (::getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) return (int)info.tcpi_unacked;
+#endif
+            return -1;
+        }
+
+        /** Get the credentials of the peer's process, for a Unix domain socket
+            @return false if they aren't available (not a Unix domain socket, or not supported on this system) */
+        bool getPeerCredentials(int & pid, int & uid, int & gid) const
+        {
+#ifdef SO_PEERCRED
+            struct ucred credentials;
+            socklen_t length = sizeof(credentials);
+            if (::getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) return false;
+            pid = (int)credentials.pid; uid = (int)credentials.uid; gid = (int)credentials.gid;
+            return true;
+#else
+            return false;
+#endif
+        }
+
         Virtual Error recv(char * buffer, const uint32 maxLength = 0, const uint32 minLength = 0)
         {
+#if UseNonBlockingSocket == 1
+            // Emulate the blocking behavior here: wait for the minimum length (or any data if none given) to be received
+            uint32 total = 0;
+            while (true)
+            {
+                int nret = ::recv(socket, &buffer[total], (minLength > total ? minLength : maxLength) - total, 0);
+                if (nret == 0) return (int)total;
+                if (nret < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return total ? (int)total : nret;
+                    if (Error err = select(true, false, NonBlockingTimeout); err.isError()) return total ? Error((int)total) : err;
+                    continue;
+                }
+                total += (uint32)nret;
+                if (total >= minLength) return (int)total;
+            }
+#endif
             int ret = 0;
             if (minLength) {
                 ret = ::recv(socket, buffer, minLength, MSG_WAITALL);
@@ -178,7 +417,219 @@ namespace Network {
 
         Virtual Error send(const char * buffer, const uint32 length)
         {
+            if (gatherBuffer)
+            {   // Only gather what leaves some room in the buffer, else send it along with the gathered data
+                if (length >= gatherSize - gathered) return sendGathered(buffer, length);
+                if (buffer != gatherBuffer + gathered) memmove(gatherBuffer + gathered, buffer, length);
+                gathered += length;
+                return (int)length;
+            }
+#if UseNonBlockingSocket == 1
+            // The whole buffer is expected to be sent here, so wait for the socket to be writable if it can't accept more data
+            uint32 sent = 0;
+            while (sent < length)
+            {
+                Error ret = trySend(&buffer[sent], length - sent);
+                if (ret.isError()) return sent ? Error((int)sent) : ret;
+                if (!ret.getCount())
+                {
+                    if (Error err = select(false, true, NonBlockingTimeout); err.isError()) return sent ? Error((int)sent) : err;
+                    continue;
+                }
+                sent += (uint32)ret.getCount();
+            }
+            return (int)sent;
+#else
             return ::send(socket, buffer, (int)length, 0);
+#endif
+        }
+
+#if UseNonBlockingSocket == 1
+        /** Send as much as possible from the given buffer without waiting
+            @return the number of bytes sent (0 if the socket can't accept any data now) or an error */
+        Error trySend(const char * buffer, const uint32 length)
+        {
+            int ret = ::send(socket, buffer, (int)length, MSG_NOSIGNAL);
+            if (ret >= 0) return ret;
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? Error(0) : Error(Sending);
+        }
+#endif
+
+#if defined(__linux__)
+        /** Send a part of a file directly from the system's file cache (with sendfile), without copying it to a buffer.
+            The gathered data (if corked) is sent first, and the system is told more data follows, so it's merged with the file's beginning.
+            This is only possible for a regular file and isn't for a TLS socket (the caller should read the file instead).
+            @param fileDescriptor   The file's descriptor
+            @param offset           The file's position to start from, it's updated with what is sent (even upon error)
+            @param length           The number of bytes to send
+            @return Success or an error */
+        Error sendFile(const int fileDescriptor, off_t & offset, std::size_t length)
+        {
+            if (gatherBuffer && gathered)
+            {
+                if (Error ret = sendGathered(nullptr, 0, MSG_NOSIGNAL | MSG_MORE); ret.isError()) return ret;
+            }
+            while (length)
+            {
+                ssize_t ret = ::sendfile(socket, fileDescriptor, &offset, min(length, MaxSendFileSize));
+                if (ret < 0)
+                {
+                    if (errno == EINTR) continue;
+  #if UseNonBlockingSocket == 1
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        if (Error err = select(false, true, NonBlockingTimeout); err.isError()) return err;
+                        continue;
+                    }
+  #endif
+                    return Sending;
+                }
+                // The file is shorter than expected
+                if (!ret) return Sending;
+                length -= (std::size_t)ret;
+            }
+            return Success;
+        }
+  #if UseNonBlockingSocket == 1
+        /** Send as much as possible of a file's part without waiting (see sendFile)
+            @return the number of bytes sent (0 if the socket can't accept any data now) or an error */
+        Error trySendFile(const int fileDescriptor, off_t & offset, const std::size_t length)
+        {
+            ssize_t ret = ::sendfile(socket, fileDescriptor, &offset, min(length, MaxSendFileSize));
+            if (ret > 0) return (int)ret;
+            // The file is shorter than expected
+            if (ret == 0) return length ? Error(Sending) : Error(0);
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? Error(0) : Error(Sending);
+        }
+  #endif
+#endif
+
+#if UseZeroCopySend == 1
+        /** Check if the socket can send without copying (see sendZeroCopy) */
+        bool canZeroCopy() const { return zeroCopy; }
+        /** Send the given buffer without copying it (MSG_ZEROCOPY), without waiting for the socket: the network card reads it while sending,
+            so it must not be changed nor freed until no zero copy send is pending (see waitZeroCopy and dropZeroCopy). The gathered data
+            (if corked) is copied and sent first. If the system can't pin more memory now, the remaining data is copied
+            @return the number of bytes sent (less than the length if the socket is full) or an error */
+        Error sendZeroCopy(const char * buffer, const uint32 length)
+        {
+            if (gatherBuffer && gathered)
+            {
+                if (Error ret = sendGathered(nullptr, 0, MSG_NOSIGNAL | MSG_MORE); ret.isError()) return ret;
+            }
+            uint32 sent = 0;
+            int flags = MSG_NOSIGNAL | MSG_ZEROCOPY;
+            while (sent < length)
+            {
+                ssize_t ret = ::send(socket, buffer + sent, length - sent, flags);
+                if (ret < 0)
+                {
+                    if (errno == EINTR) continue;
+                    // The memory that can be pinned for the socket is exhausted, so copy the remaining data
+                    if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) { flags = MSG_NOSIGNAL; continue; }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) return sent ? Error((int)sent) : Error(Sending);
+                    break;
+                }
+                if (ret && (flags & MSG_ZEROCOPY)) { ++zeroCopySends; lastZeroCopyMs = getMonotonicTimeMs(); }
+                sent += (uint32)ret;
+            }
+            return (int)sent;
+        }
+        /** Wait until the system doesn't use the memory of the zero copy sends anymore (it reports it in the socket's error queue)
+            @param timeoutMillis    The maximum time to wait, 0 to only check
+            @return Success if no zero copy send is pending, Timeout if some are still pending or an error */
+        Error waitZeroCopy(const uint32 timeoutMillis)
+        {
+            const uint32 start = timeoutMillis ? getMonotonicTimeMs() : 0;
+            while (true)
+            {
+                readZeroCopyNotifications();
+                if (zeroCopyDone == zeroCopySends) return Success;
+                const uint32 elapsed = timeoutMillis ? getMonotonicTimeMs() - start : 0;
+                if (elapsed >= timeoutMillis) return Timeout;
+                // A notification in the error queue is reported as an error on the socket
+                struct pollfd fd = { socket, 0, 0 };
+                if (::poll(&fd, 1, (int)(timeoutMillis - elapsed)) < 0 && errno != EINTR) return Select;
+            }
+        }
+        /** Get the time in milliseconds since the last zero copy send */
+        uint32 getZeroCopyAge() const { return getMonotonicTimeMs() - lastZeroCopyMs; }
+        /** Make sure the system doesn't use the memory of the zero copy sends anymore, so it can be freed. If some are still pending, the
+            connection is aborted (like a reset): the system drops all the data it still had to send, so the client never gets a partial
+            answer's changed memory. The socket must be closed afterwards
+            @return true if the connection was aborted */
+        bool dropZeroCopy()
+        {
+            readZeroCopyNotifications();
+            if (zeroCopyDone == zeroCopySends) return false;
+            // Disconnecting a TCP socket purges its send and retransmission queues, releasing the memory they reference
+            struct sockaddr address = {};
+            address.sa_family = AF_UNSPEC;
+            ::connect(socket, &address, sizeof(address));
+            zeroCopyDone = zeroCopySends;
+            return true;
+        }
+#endif
+
+        /** Send the given parts (like a chunk's size line, data and end) with a single system call, after the gathered data (if corked).
+            A TLS socket sends them one by one
+            @param parts    The parts to send, up to 4
+            @return the parts' total length or an error */
+        Error sendParts(const struct iovec * parts, const int count)
+        {
+            struct iovec all[5];
+            int n = 0;
+            uint32 total = 0;
+            if (gatherBuffer && gathered) all[n++] = { gatherBuffer, gathered };
+            for (int i = 0; i < count && i < 4; i++) { all[n++] = parts[i]; total += (uint32)parts[i].iov_len; }
+            if (getType())
+            {
+                for (int i = 0; i < n; i++) if (Error ret = send((const char*)all[i].iov_base, (uint32)all[i].iov_len); ret.isError()) return ret;
+                return (int)total;
+            }
+            gathered = 0;
+            if (Error ret = sendAll(all, n, MSG_NOSIGNAL); ret.isError()) return ret;
+            return (int)total;
+        }
+
+        /** Gather the next sends in the given buffer instead of sending them, until uncork is called.
+            A send that doesn't fit in the buffer is sent along with the gathered data in a single system call, so the many small parts of an
+            answer (status line, headers, content's beginning) don't cost a system call each. The data written in the buffer right after the
+            gathered data isn't copied. This is ignored for a TLS socket
+            @param buffer   The buffer to gather the data into, it must stay valid until uncork is called
+            @param size     The buffer's size */
+        void cork(char * buffer, const uint32 size) { if (getType()) return; gatherBuffer = buffer; gatherSize = size; gathered = 0; }
+        /** Send the gathered data (if any) and stop gathering */
+        Error uncork()
+        {
+            if (!gatherBuffer) return Success;
+            Error ret = gathered ? sendGathered(nullptr, 0) : Error(Success);
+            gatherBuffer = nullptr;
+            return ret;
+        }
+        /** Stop sending and discard the received data that isn't read yet, before closing a socket right after answering it.
+            Closing a socket with unread data makes the system reset the connection, and the peer usually drops the answer then
+            @param descriptor   The socket's descriptor */
+        static void discardInput(const int descriptor)
+        {
+            ::shutdown(descriptor, SHUT_WR);
+            // Bounded, so a peer that keeps sending can't hold the caller here
+            char buffer[1024];
+            for (int i = 0; i < 16 && ::recv(descriptor, buffer, sizeof(buffer), MSG_DONTWAIT) > 0; i++) {}
+        }
+        /** Stop sending and discard the received data that isn't read yet (see above) */
+        void discardInput() { if (socket != -1) discardInput(socket); }
+        /** Get the size of the data gathered so far (the gathering buffer is free after it) */
+        uint32 gatheredSize() const { return gathered; }
+        /** Stop gathering without sending the gathered data, it stays at the beginning of the gathering buffer.
+            This is used to send it later on without waiting for the socket (see trySend)
+            @return the size of the gathered data */
+        uint32 stopGathering()
+        {
+            const uint32 size = gatherBuffer ? gathered : 0;
+            gatherBuffer = nullptr;
+            gathered = 0;
+            return size;
         }
 
         // Useful socket helpers functions here
@@ -200,12 +651,127 @@ namespace Network {
         /** This is only used with SSL socket to avoid RTTI */
         Virtual int getType() const { return 0; }
 
-        Virtual void reset() { ::closesocket(socket); socket = -1; }
+        /** Set the textual address of the socket from the given peer address.
+            A Unix domain socket's peer has no address, so it's identified by its process identifier instead (like "unix:1234") */
+        void setAddress(const struct sockaddr_storage & peerAddress)
+        {
+            if (peerAddress.ss_family != AF_UNIX) return setAddress((const struct sockaddr_in &)peerAddress);
+            int pid = 0, uid, gid;
+            if (getPeerCredentials(pid, uid, gid)) snprintf(address, sizeof(address), "unix:%d", pid);
+            else strcpy(address, "unix");
+        }
+        /** Set the textual address of the socket from the given peer address */
+        void setAddress(const struct sockaddr_in & clientAddress)
+        {
+            sprintf(address, "%u.%u.%u.%u:%u", (unsigned)((clientAddress.sin_addr.s_addr >> 0) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 8) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 16) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 24) & 0xFF), (unsigned)clientAddress.sin_port);
+        }
+
+        Virtual void reset()
+        {
+            ::closesocket(socket); socket = -1; gatherBuffer = nullptr; gathered = 0;
+#if UseZeroCopySend == 1
+            zeroCopy = false; zeroCopySends = zeroCopyDone = 0;
+#endif
+        }
 
         bool isValid() const { return socket != -1; }
 
         BaseSocket() : socket(-1) {}
         Virtual ~BaseSocket() { ::closesocket(socket); socket = -1; }
+
+    private:
+        /** The buffer gathering the sends while corked (see cork) */
+        char *      gatherBuffer = nullptr;
+        uint32      gatherSize = 0, gathered = 0;
+#if UseZeroCopySend == 1
+        /** Whether the socket sends with MSG_ZEROCOPY */
+        bool        zeroCopy = false;
+        /** The number of zero copy sends and the number of them the system is done with (both wrap around like the system's counter) */
+        uint32      zeroCopySends = 0, zeroCopyDone = 0;
+        uint32      lastZeroCopyMs = 0;
+
+        /** Allow sending with MSG_ZEROCOPY on the given (accepted) socket, if the system supports it for this socket */
+        void enableZeroCopy(const int descriptor)
+        {
+            int n = 1;
+            zeroCopy = ::setsockopt(descriptor, SOL_SOCKET, SO_ZEROCOPY, &n, sizeof(n)) == 0;
+            zeroCopySends = zeroCopyDone = 0;
+        }
+        /** Read the zero copy completion notifications from the socket's error queue, without waiting */
+        void readZeroCopyNotifications()
+        {
+            while (zeroCopyDone != zeroCopySends)
+            {
+                char control[128];
+                struct msghdr message = {};
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+                if (::recvmsg(socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+                for (struct cmsghdr * header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+                {
+                    if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) && !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR)) continue;
+                    const struct sock_extended_err * error = (const struct sock_extended_err *)CMSG_DATA(header);
+                    if (error->ee_errno || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+                    // A notification covers a range of sends
+                    zeroCopyDone += error->ee_data - error->ee_info + 1;
+                    // The system copied the data anyway (like over the loopback interface), so stop pinning the memory for nothing
+                    if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zeroCopy = false;
+                }
+            }
+        }
+#endif
+
+#if defined(__linux__)
+        /** The maximum size sent by a single sendfile call, so the count fits in an Error */
+        static constexpr std::size_t MaxSendFileSize = 1 << 30;
+#endif
+
+        /** Send the gathered data followed by the given buffer with a single system call (or more if the socket can't accept it all at once)
+            @return the given buffer's length or an error */
+        Error sendGathered(const char * buffer, const uint32 length, const int flags = MSG_NOSIGNAL)
+        {
+            struct iovec parts[2] = { { gatherBuffer, gathered }, { (void*)buffer, length } };
+            const bool any = gathered;
+            gathered = 0;
+            if (Error ret = sendAll(any ? parts : &parts[1], any ? 2 : 1, flags); ret.isError()) return ret;
+            return (int)length;
+        }
+
+        /** Send all the given parts, with a single system call unless the socket can't accept them at once. The parts are modified */
+        Error sendAll(struct iovec * parts, const int count, const int flags)
+        {
+            struct msghdr message = {};
+            message.msg_iov = parts;
+            message.msg_iovlen = count;
+            while (message.msg_iovlen)
+            {
+                ssize_t ret = ::sendmsg(socket, &message, flags);
+                if (ret < 0)
+                {
+                    if (errno == EINTR) continue;
+#if UseNonBlockingSocket == 1
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        if (Error err = select(false, true, NonBlockingTimeout); err.isError()) return err;
+                        continue;
+                    }
+#endif
+                    return Sending;
+                }
+                // Skip what's sent
+                for (; message.msg_iovlen && (std::size_t)ret >= message.msg_iov->iov_len; message.msg_iov++, message.msg_iovlen--) ret -= message.msg_iov->iov_len;
+                if (message.msg_iovlen) { message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + ret; message.msg_iov->iov_len -= ret; }
+            }
+            return Success;
+        }
+    };
+
+    /** Gather a socket's sends while in scope (see BaseSocket::cork), the gathered data is sent when leaving the scope */
+    struct Cork
+    {
+        BaseSocket & socket;
+        Cork(BaseSocket & socket, char * buffer, const uint32 size) : socket(socket) { socket.cork(buffer, size); }
+        ~Cork() { socket.uncork(); }
     };
 
 #undef Virtual
@@ -289,9 +855,12 @@ namespace Network {
             mbedtls_pk_init(&pk);
         }
 
-        Error listen(uint16 port, int maxClientCount = 1)
+        using BaseSocket::listen;
+        Error listen(uint16 port, const ListenOptions & options)
         {
-            Error ret = BaseSocket::listen(port, maxClientCount);
+            // Not supported for TLS (there's no point for a local proxy anyway)
+            if (options.unixPath) return SocketOption;
+            Error ret = BaseSocket::listen(port, options);
             if (ret.isError()) return ret;
 
             net.fd = socket;
@@ -356,6 +925,7 @@ namespace Network {
             socklen_t addrLen = sizeof(clientAddress);
             size_t clientAddrLen = 0;
             int ret = mbedtls_net_accept(&net, &client.net, &clientAddress, addrLen, &clientAddrLen);
+            if (ret == MBEDTLS_ERR_SSL_WANT_READ) return Timeout;
             if (ret != 0) return Accept;
 
             sprintf(clientSocket.address, "%u.%u.%u.%u:%u", (unsigned)((clientAddress.sin_addr.s_addr >> 0) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 8) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 16) & 0xFF), (unsigned)((clientAddress.sin_addr.s_addr >> 24) & 0xFF), (unsigned)clientAddress.sin_port);
@@ -422,87 +992,355 @@ namespace Network {
     };
 #endif
 
+    /** A descriptor that's monitored like a socket and becomes readable once another thread notifies it (an eventfd on Linux, a pipe
+        elsewhere). It's used to wake up a thread waiting on a socket pool */
+    struct WakeUpSocket : public BaseSocket
+    {
+        /** Create the descriptor */
+        Error open()
+        {
+#if defined(__linux__)
+            socket = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            return socket == -1 ? SocketCreation : Success;
+#else
+            int fds[2];
+            if (::pipe(fds) != 0) return SocketCreation;
+            socket = fds[0]; writeEnd = fds[1];
+            for (int fd : fds) if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) return SocketOption;
+            return Success;
+#endif
+        }
+        /** Wake up the waiting thread. This can be called from any thread */
+        void notify()
+        {
+            const uint64 one = 1;
+#if defined(__linux__)
+            // This only fails if the counter overflows, it's readable anyway then
+            ssize_t ret = ::write(socket, &one, sizeof(one));
+#else
+            // If the pipe is full, it's readable anyway
+            ssize_t ret = ::write(writeEnd, &one, 1);
+#endif
+            (void)ret;
+        }
+        /** Consume the notifications, so the descriptor isn't readable anymore */
+        void consume()
+        {
+            uint64 count[8];
+            while (::read(socket, count, sizeof(count)) > 0) {}
+        }
+
+#if !defined(__linux__)
+        ~WakeUpSocket() { if (writeEnd != -1) ::close(writeEnd); }
+    private:
+        int writeEnd = -1;
+#endif
+    };
+
     /** A socket pool used to select multiple socket at once.
         The order of the sockets in the pool isn't preserved upon removing sockets (removing is done with swapping with the last used element in the array).
-        Appending sockets are always done to the end of the pool.  */
+        Appending sockets are always done to the end of the pool.
+        A socket is monitored for reading by default, use setInterest() to monitor it for writing instead.
+        This pool is using select(2) so it's rebuilding the descriptor set on each call and is limited to FD_SETSIZE descriptors */
     template <std::size_t N>
-    struct SocketPool
+    struct SelectSocketPool
     {
+        static constexpr std::size_t MaskSize = (N + 31) / 32;
+
         BaseSocket *    sockets[N] = {};
+        /** The sockets' descriptors, so building the descriptor sets only scans this dense array instead of reading each socket */
+        int             fds[N];
         std::size_t     used = 0;
-        uint32          selectMask;
+        /** The readable status for each socket in the pool, 1 bit per socket */
+        uint32          selectMask[MaskSize];
+        /** The writable status for each socket in the pool, 1 bit per socket */
+        uint32          writeMask[MaskSize];
+        /** The sockets that are monitored for reading (and writing) */
+        uint32          readInterest[MaskSize], writeInterest[MaskSize];
 
         /** Append a socket to the pool */
         bool append(BaseSocket & socket) {
-            if (used == N) return false;
+            if (used == N || socket.socket >= FD_SETSIZE) return false;
+            setBit(readInterest, used, true);
+            setBit(writeInterest, used, false);
+            fds[used] = socket.socket;
+            socket.poolPos = (uint32)used;
             sockets[used++] = &socket;
             return true;
         }
         /** Remove a socket from the pool */
         bool remove(BaseSocket & socket) {
-            if (!used) return false;
-            // Find the socket to remove
-            for (std::size_t i = 0; i < N; i++)
+            const std::size_t i = socket.poolPos;
+            if (i >= used || sockets[i] != &socket) return false;
+            std::size_t u = used - 1;
+            sockets[i] = sockets[u]; // Swap with last
+            sockets[i]->poolPos = (uint32)i;
+            fds[i] = fds[u];
+            // Swap the select status too (the removed socket's status is lost)
+            for (uint32 * mask : { selectMask, writeMask, readInterest, writeInterest })
             {
-                if (sockets[i] == &socket) {
-                    std::size_t u = used - 1;
-                    sockets[i] = sockets[u]; // Swap with last
-                    if (selectMask & (1<<u))
-                        // Swap the select status too
-                        selectMask ^= (1<<u) | ((selectMask & (1<<i)) ? 0 : (1<<i));
-                    sockets[u] = 0;
-                    --used;
-                    return true;
-                }
+                setBit(mask, i, getBit(mask, u));
+                setBit(mask, u, false);
             }
-            return false;
+            sockets[u] = 0;
+            --used;
+            return true;
         }
-        /** Select the sockets that are active for reading. Use this and getReadableSocket() to fetch the socket that's readable
+        /** Change the events the given socket is monitored for */
+        bool setInterest(BaseSocket & socket, bool reading, bool writing) {
+            const std::size_t i = socket.poolPos;
+            if (i >= used || sockets[i] != &socket) return false;
+            setBit(readInterest, i, reading);
+            setBit(writeInterest, i, writing);
+            return true;
+        }
+        /** Select the sockets that are active. Use this and getReadableSocket() or getWritableSocket() to fetch the socket that's ready
             @return positive value upon any socket readable in the pool, 0 for timeout, negative value upon error */
         Error selectActive(const uint32 timeoutMillis = (uint32)-1)
         {
             // Linux modifies the timeout when calling select
             struct timeval v = timeoutFromMs(timeoutMillis);
-            selectMask = 0;
+            Zero(selectMask);
+            Zero(writeMask);
 
-            fd_set set;
+            fd_set set, wset;
             int max = 0;
+            bool anyWrite = false;
             FD_ZERO(&set);
+            FD_ZERO(&wset);
             for (std::size_t i = 0; i < used; i++) {
                 if (sockets[i] == 0) return -1; // Impossible case, should log it
-                FD_SET(sockets[i]->socket, &set);
-                max = max > sockets[i]->socket ? max : sockets[i]->socket;
+                if (getBit(readInterest, i)) FD_SET(fds[i], &set);
+                if (getBit(writeInterest, i)) { FD_SET(fds[i], &wset); anyWrite = true; }
+                max = max > fds[i] ? max : fds[i];
             }
             // Then select
-            int ret = ::select(max + 1, &set, NULL, NULL, timeoutMillis == (uint32)-1 ? NULL : &v);
+            int ret = ::select(max + 1, &set, anyWrite ? &wset : NULL, NULL, timeoutMillis == (uint32)-1 ? NULL : &v);
             if (ret == 0) return Timeout;
             if (ret < 0) return ret;
             for (std::size_t i = 0; i < used; i++) {
-                if (FD_ISSET(sockets[i]->socket, &set)) selectMask |= (uint32)(1<<i);
+                if (FD_ISSET(fds[i], &set)) setBit(selectMask, i, true);
+                if (anyWrite && FD_ISSET(fds[i], &wset)) setBit(writeMask, i, true);
             }
             return Success;
         }
 
         /** Get the next readable socket. This doesn't work without having called selectActive() first (and it returned > 0)
             @return 0 if no more readable socket is available or the socket's pointer else */
-        BaseSocket * getReadableSocket(std::size_t startPos = 0)
+        BaseSocket * getReadableSocket(std::size_t startPos = 0) { return getNext(selectMask, startPos); }
+        /** Get the next writable socket. This doesn't work without having called selectActive() first (and it returned > 0)
+            @return 0 if no more writable socket is available or the socket's pointer else */
+        BaseSocket * getWritableSocket(std::size_t startPos = 0) { return getNext(writeMask, startPos); }
+        /** Check if a specific socket position is readable */
+        bool isReadable(std::size_t pos) const { return getBit(selectMask, pos); }
+        /** Check if a specific socket position is writable */
+        bool isWritable(std::size_t pos) const { return getBit(writeMask, pos); }
+
+        SelectSocketPool() : used(0) { Zero(sockets); Zero(fds); Zero(selectMask); Zero(writeMask); Zero(readInterest); Zero(writeInterest); }
+
+    private:
+        static bool getBit(const uint32 * mask, std::size_t pos) { return mask[pos / 32] & (1U << (pos & 31)); }
+        static void setBit(uint32 * mask, std::size_t pos, bool set)
+        {
+            if (set) mask[pos / 32] |= (1U << (pos & 31));
+            else     mask[pos / 32] &= ~(1U << (pos & 31));
+        }
+        BaseSocket * getNext(uint32 * mask, std::size_t startPos)
         {
-            if (!selectMask) return 0;
             for (std::size_t i = startPos; i < used; i++) {
-                if ((selectMask & (1<<i))) {
-                    selectMask ^= (uint32)(1<<i);
+                // Skip the whole word if nothing is ready in it
+                if (!mask[i / 32]) { i |= 31; continue; }
+                if (getBit(mask, i)) {
+                    setBit(mask, i, false);
                     return sockets[i];
                 }
             }
-            // Should never happens
             return 0;
         }
+    };
+
+#if defined(__linux__)
+    /** A socket pool using epoll(7) to monitor multiple socket at once.
+        It has the same interface as the SelectSocketPool above but the sockets are registered once in the kernel (upon append) and
+        only the ready sockets are returned by selectActive(), so the cost of each loop only depends on the number of active sockets,
+        not on the number of registered sockets. Each socket knows its position and each position knows its ready event (if any), so
+        removing a socket or checking a position doesn't search anything either.
+        The position of a socket in the pool follows the same rule as the SelectSocketPool (removing swaps with the last element) */
+    template <std::size_t N>
+    struct EPollSocketPool
+    {
+        /** The events that are reported as readable or writable */
+        static constexpr uint32 ReadEvents = EPOLLIN | EPOLLERR | EPOLLHUP, WriteEvents = EPOLLOUT | EPOLLERR | EPOLLHUP;
+
+        BaseSocket *    sockets[N] = {};
+        std::size_t     used = 0;
+        /** The epoll instance descriptor */
+        int             epollFD;
+        /** The ready events as reported by the kernel. The events are cleared once consumed */
+        epoll_event     events[N];
+        /** The index of each position's ready event. It's only valid if this event refers to the position's socket (so it's never cleared) */
+        uint32          readyIndex[N] = {};
+        /** The number of valid ready events and the first one that wasn't consumed yet for reading and for writing */
+        std::size_t     readyCount = 0, firstRead = 0, firstWrite = 0;
+
+        /** Append a socket to the pool */
+        bool append(BaseSocket & socket) {
+            if (used == N || epollFD == -1) return false;
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &socket;
+            if (::epoll_ctl(epollFD, EPOLL_CTL_ADD, socket.socket, &ev) != 0) return false;
+            socket.poolPos = (uint32)used;
+            sockets[used++] = &socket;
+            return true;
+        }
+        /** Remove a socket from the pool */
+        bool remove(BaseSocket & socket) {
+            const std::size_t i = socket.poolPos;
+            if (i >= used || sockets[i] != &socket) return false;
+            // This can fail if the socket was already closed (the kernel already removed it then), it's not an error
+            ::epoll_ctl(epollFD, EPOLL_CTL_DEL, socket.socket, nullptr);
+            // Forget any pending event for this socket
+            if (epoll_event * event = getEvent(i)) event->events = 0;
+            std::size_t u = used - 1;
+            sockets[i] = sockets[u]; // Swap with last
+            sockets[i]->poolPos = (uint32)i;
+            readyIndex[i] = readyIndex[u];
+            sockets[u] = 0;
+            --used;
+            return true;
+        }
+        /** Change the events the given socket is monitored for */
+        bool setInterest(BaseSocket & socket, bool reading, bool writing) {
+            epoll_event ev = {};
+            ev.events = (reading ? (uint32)EPOLLIN : 0) | (writing ? (uint32)EPOLLOUT : 0);
+            ev.data.ptr = &socket;
+            return ::epoll_ctl(epollFD, EPOLL_CTL_MOD, socket.socket, &ev) == 0;
+        }
+        /** Wait for the sockets that are active. Use this and getReadableSocket() or getWritableSocket() to fetch the socket that's ready
+            @return positive value upon any socket readable in the pool, 0 for timeout, negative value upon error */
+        Error selectActive(const uint32 timeoutMillis = (uint32)-1)
+        {
+            readyCount = firstRead = firstWrite = 0;
+            int ret = ::epoll_wait(epollFD, events, (int)N, timeoutMillis == (uint32)-1 ? -1 : (int)timeoutMillis);
+            if (ret == 0 || (ret < 0 && errno == EINTR)) return Timeout;
+            if (ret < 0) return Select;
+            readyCount = (std::size_t)ret;
+            for (std::size_t i = 0; i < readyCount; i++) readyIndex[((BaseSocket*)events[i].data.ptr)->poolPos] = (uint32)i;
+            return Success;
+        }
+
+        /** Get the next readable socket. This doesn't work without having called selectActive() first (and it returned > 0)
+            @return 0 if no more readable socket is available or the socket's pointer else */
+        BaseSocket * getReadableSocket(std::size_t startPos = 0) { return getNext(ReadEvents, firstRead, startPos); }
+        /** Get the next writable socket. This doesn't work without having called selectActive() first (and it returned > 0)
+            @return 0 if no more writable socket is available or the socket's pointer else */
+        BaseSocket * getWritableSocket(std::size_t startPos = 0) { return getNext(WriteEvents, firstWrite, startPos); }
         /** Check if a specific socket position is readable */
-        bool isReadable(std::size_t pos) const { return selectMask & (1<<pos); }
+        bool isReadable(std::size_t pos) const { return hasEvent(ReadEvents, pos); }
+        /** Check if a specific socket position is writable */
+        bool isWritable(std::size_t pos) const { return hasEvent(WriteEvents, pos); }
+
+        EPollSocketPool() : used(0), epollFD(::epoll_create1(EPOLL_CLOEXEC)) { Zero(sockets); }
+        ~EPollSocketPool() { if (epollFD != -1) ::close(epollFD); }
+
+    private:
+        /** Get the ready event of the given position, if any */
+        epoll_event * getEvent(std::size_t pos)
+        {
+            const std::size_t i = readyIndex[pos];
+            return i < readyCount && events[i].data.ptr == sockets[pos] ? &events[i] : nullptr;
+        }
+        bool hasEvent(uint32 mask, std::size_t pos) const {
+            if (pos >= used) return false;
+            const epoll_event * event = const_cast<EPollSocketPool*>(this)->getEvent(pos);
+            return event && (event->events & mask);
+        }
+        /** Get the next ready socket for the given events. The events before the given first one are either consumed for these events or
+            for a position before the start position, so they are never checked again */
+        BaseSocket * getNext(uint32 mask, std::size_t & first, std::size_t startPos)
+        {
+            for (std::size_t i = first; i < readyCount; i++) {
+                if (!(events[i].events & mask)) { if (i == first) ++first; continue; }
+                BaseSocket * socket = (BaseSocket*)events[i].data.ptr;
+                if (socket->poolPos < startPos) continue;
+                // An error or hangup is only reported once
+                events[i].events &= ~mask;
+                if (i == first) ++first;
+                return socket;
+            }
+            return 0;
+        }
+    };
+#endif
+
+    /** A socket pool for a server driven by a host's event loop (with the server's onReadable(), onWritable() and onTimer() methods).
+        It doesn't wait for the sockets itself, it only tracks the monitored sockets with their interest, so the host can list them with
+        forEach(), and it reports each change to the interest callback, so the host can update its own registrations (like with epoll_ctl).
+        The descriptor given to the callback when a socket is removed is the one it was appended with (the socket can be closed already).
+        The callback also gets a cookie for the socket, that the host gives back to the server's onReadable() and onWritable(), so the server
+        finds the socket (or the client) without searching */
+    template <std::size_t N>
+    struct ExternalSocketPool
+    {
+        /** Called when a socket is appended (monitored for reading), removed (monitored for nothing) or its interest changes */
+        typedef void (*InterestCallback)(void * opaque, int fd, void * cookie, bool reading, bool writing);
+        InterestCallback    onInterest = nullptr;
+        /** The callback's first argument */
+        void *              opaque = nullptr;
+
+        BaseSocket *    sockets[N] = {};
+        /** The socket's descriptors, as appended */
+        int             fds[N] = {};
+        /** The socket's interest (a combination of Reading and Writing) */
+        uint8           interest[N] = {};
+        std::size_t     used = 0;
+
+        enum : uint8 { Reading = 1, Writing = 2 };
 
-        SocketPool() : used(0), selectMask(0) { Zero(sockets); }
+        /** Append a socket to the pool */
+        bool append(BaseSocket & socket) {
+            if (used == N) return false;
+            socket.poolPos = (uint32)used;
+            sockets[used] = &socket; fds[used] = socket.socket; interest[used++] = Reading;
+            if (onInterest) onInterest(opaque, socket.socket, &socket, true, false);
+            return true;
+        }
+        /** Remove a socket from the pool */
+        bool remove(BaseSocket & socket) {
+            const std::size_t i = socket.poolPos;
+            if (i >= used || sockets[i] != &socket) return false;
+            const int fd = fds[i];
+            std::size_t u = --used;
+            // Swap with last
+            sockets[i] = sockets[u]; fds[i] = fds[u]; interest[i] = interest[u];
+            sockets[i]->poolPos = (uint32)i;
+            sockets[u] = 0;
+            if (onInterest) onInterest(opaque, fd, &socket, false, false);
+            return true;
+        }
+        /** Change the events the given socket is monitored for */
+        bool setInterest(BaseSocket & socket, bool reading, bool writing) {
+            const std::size_t i = socket.poolPos;
+            if (i >= used || sockets[i] != &socket) return false;
+            interest[i] = (reading ? Reading : 0) | (writing ? Writing : 0);
+            if (onInterest) onInterest(opaque, fds[i], &socket, reading, writing);
+            return true;
+        }
+        /** Check if the given socket is monitored (a cookie given back by the host can be for a socket removed meanwhile) */
+        bool contains(const BaseSocket & socket) const { return socket.poolPos < used && sockets[socket.poolPos] == &socket; }
+        /** Call the given function with (int fd, void * cookie, bool reading, bool writing) for each monitored socket */
+        template <typename Func>
+        void forEach(Func && f) const { for (std::size_t i = 0; i < used; i++) f(fds[i], (void*)sockets[i], (interest[i] & Reading) != 0, (interest[i] & Writing) != 0); }
     };
 
+#if UseEPoll == 1
+    /** The socket pool used by the server */
+    template <std::size_t N> using SocketPool = EPollSocketPool<N>;
+#else
+    /** The socket pool used by the server */
+    template <std::size_t N> using SocketPool = SelectSocketPool<N>;
+#endif
 
 }
 
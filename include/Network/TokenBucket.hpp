@@ -0,0 +1,81 @@
+#ifndef hpp_TokenBucket_hpp
+#define hpp_TokenBucket_hpp
+
+// We need types
+#include "Types.hpp"
+// We need the configuration for the burst
+#include "HTTPDConfig.hpp"
+// We need atomic for the shared bucket's lock
+#include <atomic>
+#include <cstddef>
+
+namespace Network
+{
+    /** A token bucket limiting a rate in bytes per second.
+        The bucket fills at the given rate, up to ShaperBurstMs worth of data, and sending some data takes as many tokens.
+        The tokens are counted in thousandths of bytes so no fraction is lost whatever the elapsed time between 2 uses.
+        The time is a 32 bits millisecond counter (that can wrap around). */
+    struct TokenBucket
+    {
+        /** The rate in bytes per second (0 for no limit) */
+        uint32      rate = 0;
+        /** The time (in ms) the bucket was last filled at */
+        uint32      last = 0;
+        /** The available tokens, in thousandths of bytes */
+        uint64      credit = 0;
+
+        /** Set the rate and start with a full bucket */
+        void setRate(const uint32 bytesPerSecond, const uint32 now) { rate = bytesPerSecond; last = now; credit = burst(); }
+        /** The maximum number of bytes that can be sent at once */
+        std::size_t burstSize() const { std::size_t size = (std::size_t)((uint64)rate * ShaperBurstMs / 1000); return size ? size : 1; }
+
+        /** Get the time to wait (in ms) until the given size is available (0 if it's available now) */
+        uint32 delayFor(const std::size_t size, const uint32 now)
+        {
+            if (!rate) return 0;
+            fill(now);
+            const uint64 wanted = (uint64)size * 1000;
+            if (credit >= wanted) return 0;
+            // Round up, else the caller would wake up too early
+            return (uint32)((wanted - credit + rate - 1) / rate);
+        }
+        /** Take the tokens for the given size (they must be available, see delayFor) */
+        void take(const std::size_t size) { if (rate) credit -= (uint64)size * 1000; }
+        /** Give back the tokens that were taken but not used */
+        void giveBack(const std::size_t size) { if (!rate) return; credit += (uint64)size * 1000; if (credit > burst()) credit = burst(); }
+
+    private:
+        uint64 burst() const { return (uint64)burstSize() * 1000; }
+        void fill(const uint32 now)
+        {
+            // Another thread might have filled it with a later time meanwhile
+            if ((int32)(now - last) <= 0) return;
+            credit += (uint64)(uint32)(now - last) * rate;
+            last = now;
+            if (credit > burst()) credit = burst();
+        }
+    };
+
+    /** A token bucket shared by multiple threads (like all the servers of a MultiServer).
+        It's protected by a spin lock since the lock is only held for a few instructions */
+    struct SharedTokenBucket
+    {
+        /** Run the given function with the locked bucket */
+        template <typename Func>
+        auto locked(Func && func)
+        {
+            while (lock.test_and_set(std::memory_order_acquire)) {}
+            auto ret = func(bucket);
+            lock.clear(std::memory_order_release);
+            return ret;
+        }
+
+        SharedTokenBucket(const uint32 bytesPerSecond, const uint32 now) { bucket.setRate(bytesPerSecond, now); }
+
+    private:
+        TokenBucket         bucket;
+        std::atomic_flag    lock = ATOMIC_FLAG_INIT;
+    };
+}
+
+#endif
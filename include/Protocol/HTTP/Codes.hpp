@@ -176,4 +176,82 @@ namespace Refl
 
 }
 
+namespace Protocol::HTTP
+{
+    /** A status line (like "HTTP/1.1 200 Ok\r\n") */
+    struct StatusLine
+    {
+        char    text[40];
+        uint8   length;
+    };
+    /** Build the status line for the given code */
+    constexpr StatusLine makeStatusLine(const Code code)
+    {
+        StatusLine line = {};
+        for (const char * p = "HTTP/1.1 "; *p; p++) line.text[line.length++] = *p;
+        line.text[line.length++] = (char)('0' + (int)code / 100);
+        line.text[line.length++] = (char)('0' + (int)code / 10 % 10);
+        line.text[line.length++] = (char)('0' + (int)code % 10);
+        line.text[line.length++] = ' ';
+        for (const char * p = Refl::toString(code); *p; p++) line.text[line.length++] = *p;
+        line.text[line.length++] = '\r';
+        line.text[line.length++] = '\n';
+        return line;
+    }
+    /** The status line of each code, built at compile time */
+    template <Code code> inline constexpr StatusLine statusLine = makeStatusLine(code);
+
+    /** Get the status line for the given code, so sending it doesn't need any conversion
+        @return A pointer on the status line or nullptr if the code is unknown */
+    constexpr const StatusLine * getStatusLine(const Code code)
+    {
+        switch(code)
+        {
+        case Code::Continue                : return &statusLine<Code::Continue>;
+        case Code::Ok                      : return &statusLine<Code::Ok>;
+        case Code::Created                 : return &statusLine<Code::Created>;
+        case Code::Accepted                : return &statusLine<Code::Accepted>;
+        case Code::NonAuthInfo             : return &statusLine<Code::NonAuthInfo>;
+        case Code::NoContent               : return &statusLine<Code::NoContent>;
+        case Code::ResetContent            : return &statusLine<Code::ResetContent>;
+        case Code::PartialContent          : return &statusLine<Code::PartialContent>;
+        case Code::MultipleChoices         : return &statusLine<Code::MultipleChoices>;
+        case Code::MovedForever            : return &statusLine<Code::MovedForever>;
+        case Code::MovedTemporarily        : return &statusLine<Code::MovedTemporarily>;
+        case Code::SeeOther                : return &statusLine<Code::SeeOther>;
+        case Code::NotModified             : return &statusLine<Code::NotModified>;
+        case Code::UseProxy                : return &statusLine<Code::UseProxy>;
+        case Code::Unused                  : return &statusLine<Code::Unused>;
+        case Code::TemporaryRedirect       : return &statusLine<Code::TemporaryRedirect>;
+        case Code::BadRequest              : return &statusLine<Code::BadRequest>;
+        case Code::Unauthorized            : return &statusLine<Code::Unauthorized>;
+        case Code::PaymentRequired         : return &statusLine<Code::PaymentRequired>;
+        case Code::Forbidden               : return &statusLine<Code::Forbidden>;
+        case Code::NotFound                : return &statusLine<Code::NotFound>;
+        case Code::BadMethod               : return &statusLine<Code::BadMethod>;
+        case Code::NotAcceptable           : return &statusLine<Code::NotAcceptable>;
+        case Code::ProxyRequired           : return &statusLine<Code::ProxyRequired>;
+        case Code::TimedOut                : return &statusLine<Code::TimedOut>;
+        case Code::Conflict                : return &statusLine<Code::Conflict>;
+        case Code::Gone                    : return &statusLine<Code::Gone>;
+        case Code::LengthRequired          : return &statusLine<Code::LengthRequired>;
+        case Code::PreconditionFail        : return &statusLine<Code::PreconditionFail>;
+        case Code::EntityTooLarge          : return &statusLine<Code::EntityTooLarge>;
+        case Code::URITooLarge             : return &statusLine<Code::URITooLarge>;
+        case Code::UnsupportedMIME         : return &statusLine<Code::UnsupportedMIME>;
+        case Code::RequestRange            : return &statusLine<Code::RequestRange>;
+        case Code::ExpectationFail         : return &statusLine<Code::ExpectationFail>;
+        case Code::InternalServerError     : return &statusLine<Code::InternalServerError>;
+        case Code::NotImplemented          : return &statusLine<Code::NotImplemented>;
+        case Code::BadGateway              : return &statusLine<Code::BadGateway>;
+        case Code::Unavailable             : return &statusLine<Code::Unavailable>;
+        case Code::GatewayTimedOut         : return &statusLine<Code::GatewayTimedOut>;
+        case Code::UnsupportedHTTPVersion  : return &statusLine<Code::UnsupportedHTTPVersion>;
+        case Code::ConnectionTimedOut      : return &statusLine<Code::ConnectionTimedOut>;
+        case Code::ClientRequestError      : return &statusLine<Code::ClientRequestError>;
+        default: return nullptr;
+        }
+    }
+}
+
 #endif
@@ -37,8 +37,8 @@ namespace Protocol::HTTP
     template <typename Client>
     struct PersistBase : public PersistantTag
     {
-        template <std::size_t N>
-        inline bool persist(Container::TranscientVault<N> & buffer, std::size_t futureDrop = 0) { return static_cast<Client*>(this)->persist(buffer, futureDrop); }
+        template <std::size_t N, bool A>
+        inline bool persist(Container::TranscientVault<N, A> & buffer, std::size_t futureDrop = 0) { return static_cast<Client*>(this)->persist(buffer, futureDrop); }
     };
 
 
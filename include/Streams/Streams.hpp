@@ -12,6 +12,13 @@
 #include "Strings/RWString.hpp"
 // We need socket code too
 #include "Network/Socket.hpp"
+// We need fstat and pread for file descriptor streams, and mmap for mapped file streams
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+// We need concepts for the descriptor backed streams
+#include <concepts>
 
 /** This is where streams are declared */
 namespace Streams
@@ -179,9 +186,15 @@ namespace Streams
         template <typename ... T>  Empty(T&&...) {}
     };
 
-    /** A memory backed buffer stream. This isn't allocating any buffer */
-    struct MemoryView : public Input<MemoryView>
+    /** A memory backed buffer stream. This isn't allocating any buffer.
+        @param isBorrowed   If true, the memory is only valid while the code that built the view runs (see MemoryView), else it
+                            outlives any user of the stream (see StaticView) */
+    template <bool isBorrowed>
+    struct BasicMemoryView : public Input<BasicMemoryView<isBorrowed>>
     {
+        /** Whether the viewed memory might not outlive this stream's user (see Borrowed) */
+        static constexpr bool borrowed = isBorrowed;
+
         std::size_t getSize() const             { return (std::size_t)buffer.getLength(); }
         bool hasContent() const                 { return getSize() > 0; }
         std::size_t getPos() const              { return pos; }
@@ -205,14 +218,19 @@ namespace Streams
         // }
 
     public:
-        MemoryView(const uint8 * buffer, std::size_t size) : buffer((const char*)buffer, (int)size), pos(0) {}
-        MemoryView(const ROString & buffer) : buffer(buffer), pos(0) {}
+        BasicMemoryView(const uint8 * buffer, std::size_t size) : buffer((const char*)buffer, (int)size), pos(0) {}
+        BasicMemoryView(const ROString & buffer) : buffer(buffer), pos(0) {}
 
     private:
         ROString buffer;
         std::size_t pos;
     };
 
+    /** A view on a memory that's borrowed: an answer that can't be sent at once copies it instead of sending it once the route returned */
+    using MemoryView = BasicMemoryView<true>;
+    /** A view on a memory that outlives any answer (like a static or global buffer), so it's sent in place even once the route returned */
+    using StaticView = BasicMemoryView<false>;
+
     /** A file based input stream */
     struct FileInput final : public Input<FileInput>, public Private::FileBase
     {
@@ -226,6 +244,118 @@ namespace Streams
         FileInput(FileInput && input) : FileBase(std::move(input)) {}
     };
 
+    /** A file descriptor based input stream. Unlike FileInput, it doesn't buffer anything.
+        When it's a regular file, the server sends it with sendfile (on Linux, and if the socket isn't a TLS one), so the file's content isn't
+        copied to the client's buffer. Otherwise it's read like any other stream (a pipe's size is unknown, so it's sent chunked). */
+    struct FileDescInput final : public Input<FileDescInput>, public Private::NonMappeable
+    {
+        std::size_t getSize() const             { return size; }
+        bool hasContent() const                 { return fd >= 0; }
+        std::size_t getPos() const              { return pos; }
+        bool setPos(const std::size_t pos)      { return regular && pos <= size ? this->pos = pos, true : false; }
+        std::size_t read(void * buf, const std::size_t size)
+        {
+            if (fd < 0) return 0;
+            ssize_t ret = regular ? ::pread(fd, buf, size, (off_t)pos) : ::read(fd, buf, size);
+            if (ret <= 0) return 0;
+            pos += (std::size_t)ret;
+            return (std::size_t)ret;
+        }
+        /** Get the file's descriptor (or -1 if it's not opened) */
+        int getDescriptor() const               { return fd; }
+        /** Check if the file is a regular file (only those can be sent with sendfile) */
+        bool isRegular() const                  { return regular; }
+
+        FileDescInput(const char * path) : FileDescInput(::open(path, O_RDONLY | O_CLOEXEC)) {}
+        /** Build from an opened descriptor, that's owned (and closed) by this stream */
+        FileDescInput(const int fileDescriptor) : fd(fileDescriptor), size(0), pos(0), regular(false)
+        {
+            struct stat info;
+            if (fd < 0 || ::fstat(fd, &info) < 0) { close(); return; }
+            regular = S_ISREG(info.st_mode);
+            if (regular) size = (std::size_t)info.st_size;
+        }
+        ~FileDescInput() { close(); }
+
+        FileDescInput(const FileDescInput &) = delete;
+        FileDescInput(FileDescInput && input) : fd(input.fd), size(input.size), pos(input.pos), regular(input.regular) { input.fd = -1; input.size = 0; }
+
+    private:
+        void close() { if (fd >= 0) ::close(fd); fd = -1; size = 0; }
+        int fd;
+        std::size_t size, pos;
+        bool regular;
+    };
+
+    /** A memory mapped file input stream. The whole file is mapped when opened, so it can be used in place (see Mappable) instead of
+        being read in a buffer. Reading it only copies from the mapping. */
+    struct MappedFileInput final : public Input<MappedFileInput>
+    {
+        std::size_t getSize() const             { return size; }
+        bool hasContent() const                 { return opened; }
+        std::size_t getPos() const              { return pos; }
+        bool setPos(const std::size_t pos)      { return pos <= size ? this->pos = pos, true : false; }
+
+        void * map(const std::size_t size = 0)  { return size <= this->size ? data : nullptr; }
+        void unmap(void * buffer)               { }
+        std::size_t read(void * buf, const std::size_t size)
+        {
+            std::size_t q = min(this->size - pos, size);
+            if (q) memcpy(buf, data + pos, q);
+            pos += q;
+            return q;
+        }
+
+        MappedFileInput(const char * path) : data(nullptr), size(0), pos(0), opened(false)
+        {
+            int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+            struct stat info;
+            if (fd < 0) return;
+            if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+            {
+                opened = true;
+                // An empty file can't be mapped, but it's still a file
+                void * mapping = info.st_size ? ::mmap(nullptr, (std::size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+                if (mapping != MAP_FAILED)
+                {
+                    ::madvise(mapping, (std::size_t)info.st_size, MADV_SEQUENTIAL);
+                    data = (char*)mapping;
+                    size = (std::size_t)info.st_size;
+                } else opened = info.st_size == 0;
+            }
+            // The mapping stays valid once the descriptor is closed
+            ::close(fd);
+        }
+        ~MappedFileInput() { if (data) ::munmap(data, size); }
+
+        MappedFileInput(const MappedFileInput &) = delete;
+        MappedFileInput(MappedFileInput && input) : data(input.data), size(input.size), pos(input.pos), opened(input.opened) { input.data = nullptr; input.size = 0; input.opened = false; }
+
+    private:
+        char * data;
+        std::size_t size, pos;
+        bool opened;
+    };
+
+    /** A stream that can be mapped (see Base::map), so its content can be used in place instead of being read in a buffer */
+    template <typename Stream>
+    concept Mappable = std::is_base_of_v<Input<Stream>, Stream> && !std::is_base_of_v<Private::NonMappeable, Stream>;
+
+    /** A stream that views a memory it doesn't own, and that might be released once its user returns (see MemoryView) */
+    template <typename Stream>
+    concept Borrowed = requires { requires Stream::borrowed; };
+
+    /** A stream that can be sent directly from its file descriptor (see FileDescInput) */
+    template <typename Stream>
+    concept DescriptorBacked = requires (const Stream & stream) {
+        { stream.getDescriptor() } -> std::convertible_to<int>;
+        { stream.isRegular() } -> std::convertible_to<bool>;
+    };
+
+    /** A stream whose content can be used in place, from its mapping or its file descriptor, instead of being read in a buffer */
+    template <typename Stream>
+    concept InPlace = Mappable<Stream> || DescriptorBacked<Stream>;
+
     /** A file based output stream */
     struct FileOutput final : public Output<FileOutput>, public Private::FileBase
     {
@@ -269,7 +399,7 @@ namespace Streams
         std::size_t  bufSize;
     };
 
-    /** A chunk based output stream, following HTTP/1.1 RFC standard */
+    /** A chunk based output stream, following HTTP/1.1 RFC standard. Each write is sent as a chunk (size line, data and end) with a single system call */
     struct ChunkedOutput final : public Output<ChunkedOutput>, public Private::NonSeekable, public Private::NonMappeable, public Private::WithContent
     {
         std::size_t getSize() const { return 0; }
@@ -279,17 +409,127 @@ namespace Streams
             intToStr((int)size, buffer, 16);
             std::size_t l = strlen(buffer);
             memcpy(&buffer[l], "\r\n", 2);
-            if (socketStream.write(buffer, l+2) != l+2) return 0;
-            // Write chunk data
-            if (socketStream.write(buf, size) != size) return 0;
-            // Write end of this chunk
-            if (socketStream.write("\r\n", 2) != 2) return 0;
+            // Then the chunk data and the end of this chunk, all at once
+            struct iovec parts[3] = { { buffer, l + 2 }, { (void*)buf, size }, { (void*)"\r\n", 2 } };
+            if (!(socket->sendParts(parts, 3) == l + 4 + size)) return 0;
             return size;
         }
 
-        ChunkedOutput(Network::BaseSocket & socket) : socketStream(socket) {}
+        ChunkedOutput(Network::BaseSocket & socket) : socket(&socket) {}
     protected:
-        Socket socketStream;
+        Network::BaseSocket * socket;
+    };
+
+    /** A chunk based output stream that accumulates the written data in the given buffer, and only sends a chunk once the buffered data
+        reaches the watermark (or when flushed), instead of a chunk per write. So many small writes (like a word at a time) cost a few system
+        calls and packets. Each chunk is sent with a single system call, and the last chunk is sent along with the remaining data when the
+        stream is closed (by writing nothing). A write that's larger than the buffer is sent as its own chunk.
+        The buffer can be a corked socket's free gathering buffer (after the gathered data), the chunks are then sent with the gathered data.
+        Without a socket, the stream only frames a chunk in the buffer (see take), for a chunked answer that's sent later on */
+    struct BufferedChunkedOutput final : public Output<BufferedChunkedOutput>, public Private::NonSeekable, public Private::NonMappeable, public Private::WithContent
+    {
+        std::size_t getSize() const { return 0; }
+        std::size_t write(const void * buf, const std::size_t size)
+        {
+            if (!socket)
+            {   // Only take what fits, the chunk is ready once the watermark is reached (or the buffer is full)
+                const std::size_t length = min(size, capacity - used);
+                memcpy(buffer + HeadRoom + used, buf, length);
+                used += length;
+                if (used >= watermark || length < size) ready = true;
+                return length;
+            }
+            if (!size) { close(); return 0; }
+            if (used + size > capacity && !flush()) return 0;
+            if (size > capacity) return ChunkedOutput(*socket).write(buf, size);
+            memcpy(buffer + HeadRoom + used, buf, size);
+            used += size;
+            if (used >= watermark && !flush()) return 0;
+            return size;
+        }
+        /** Send the buffered data as a chunk now (for a latency sensitive stream)
+            @return false upon error */
+        bool flush() { if (!socket) return ready = true; return sendBuffered(false); }
+        /** Send the buffered data and the last chunk, ending the stream
+            @return false upon error */
+        bool close() { if (!socket) return ready = true; return sendBuffered(true); }
+
+        /** Check if the buffered chunk should be sent now (without a socket) */
+        bool isReady() const { return ready; }
+        /** Frame the buffered data as a chunk (and the last chunk after it if asked) at the buffer's beginning (without a socket)
+            @return the chunk's size in the buffer */
+        std::size_t take(const bool last)
+        {
+            if (!capacity) return 0;
+            char * start = nullptr, * end = frame(last, start);
+            memmove(buffer, start, (std::size_t)(end - start));
+            ready = false;
+            return (std::size_t)(end - start);
+        }
+
+        /** Construct the stream
+            @param buffer       The buffer to accumulate the data in (like the client's free buffer space), it must stay valid while the stream is used
+            @param size         The buffer's size in bytes. Some bytes are kept for the chunks' size line and end
+            @param watermark    The buffered size that triggers sending a chunk, 0 (or a size larger than the buffer) for as much as the buffer can hold */
+        BufferedChunkedOutput(Network::BaseSocket & socket, char * buffer, const std::size_t size, const std::size_t watermark = 0)
+            : socket(&socket), buffer(buffer), capacity(size > HeadRoom + TailRoom ? size - HeadRoom - TailRoom : 0), used(0),
+              watermark(watermark && watermark < capacity ? watermark : capacity) {}
+        /** Construct the stream without a socket, the chunks are framed in the buffer and taken from it instead (see take) */
+        BufferedChunkedOutput(char * buffer, const std::size_t size, const std::size_t watermark = 0)
+            : socket(nullptr), buffer(buffer), capacity(size > HeadRoom + TailRoom ? size - HeadRoom - TailRoom : 0), used(0),
+              watermark(watermark && watermark < capacity ? watermark : capacity) {}
+
+    protected:
+        /** The room kept before the data for the chunk's size line, and after it for the chunk's end and the last chunk */
+        static constexpr std::size_t HeadRoom = sizeof("FFFFFFFF\r\n") - 1, TailRoom = sizeof("\r\n0\r\n\r\n") - 1;
+
+        /** Write the size line right before the buffered data and the chunk's end right after it (and the last chunk if asked)
+            @param start    Set to the chunk's beginning
+            @return the chunk's end */
+        char * frame(const bool last, char *& start)
+        {
+            start = buffer + HeadRoom;
+            char * end = start + used;
+            if (used)
+            {
+                char line[sizeof("FFFFFFFF")] = {};
+                intToStr((int)used, line, 16);
+                std::size_t l = strlen(line);
+                start -= l + 2;
+                memcpy(start, line, l);
+                memcpy(start + l, "\r\n", 2);
+                memcpy(end, "\r\n", 2);
+                end += 2;
+            }
+            used = 0;
+            if (last)
+            {
+                memcpy(end, "0\r\n\r\n", 5);
+                end += 5;
+            }
+            return end;
+        }
+
+        /** Send the buffered data as a chunk (and the last chunk after it if asked), with a single system call */
+        bool sendBuffered(const bool last)
+        {
+            if (!capacity) return !last || socket->send("0\r\n\r\n", 5) == 5;
+            char * start = nullptr, * end = frame(last, start);
+            if (!last)
+            {   // Always sent now, along with the data the socket gathered (if corked, like the answer's head)
+                if (end == start) return true;
+                struct iovec part = { start, (std::size_t)(end - start) };
+                return socket->sendParts(&part, 1) == (std::size_t)(end - start);
+            }
+            // The last chunk can be gathered by a corked socket, so a short answer is sent with its head in a single system call
+            return socket->send(start, (uint32)(end - start)) == (std::size_t)(end - start);
+        }
+
+        Network::BaseSocket * socket;
+        char *      buffer;
+        std::size_t capacity, used, watermark;
+        /** Whether the buffered chunk should be sent now (without a socket) */
+        bool        ready = false;
     };
 
 
@@ -362,11 +602,28 @@ namespace Streams
 
 
 
-    /** Copy a stream to another one until either one fails or the total amount specified is reached, using the given buffer
+    /** Copy a stream to another one until either one fails or the total amount specified is reached, using the given buffer.
+        A mappable input (see Mappable) is written from its mapping at once instead, so the buffer isn't used
         @return the number of bytes copied */
     template <typename In, typename Out>
     std::size_t copy(In & in, Out & out, uint8 * buffer, std::size_t bufSize, const std::size_t size = (std::size_t)-1)
     {
+        if constexpr (Mappable<In>)
+        {
+            if (const uint8 * data = (const uint8*)in.map())
+            {
+                std::size_t pos = in.getPos(), length = min(in.getSize() - pos, size), total = 0;
+                while (total < length)
+                {   // Split huge writes, so any output's size type can hold them
+                    std::size_t step = min(length - total, (std::size_t)1 << 30), c = out.write(data + pos + total, step);
+                    total += c;
+                    if (c != step) break;
+                }
+                in.setPos(pos + total);
+                in.unmap((void*)data);
+                return total;
+            }
+        }
         std::size_t total = 0, step = 0;
         while (true)
         {
@@ -380,12 +637,18 @@ namespace Streams
     }
 
     /** Copy a stream to another one until either one fails or the total amount specified is reached
+        @param BufferSize   The size of the buffer on the stack used for a non mappable input (like copy<4096>(in, out))
         @return the number of bytes copied */
-    template <typename In, typename Out>
+    template <std::size_t BufferSize = 256, typename In, typename Out>
     std::size_t copy(In & in, Out & out, const std::size_t size = (std::size_t)-1)
     {
-        uint8 buffer[256];
-        return copy(in, out, buffer, sizeof(buffer), size);
+        if constexpr (Mappable<In>)
+            return copy(in, out, nullptr, 0, size);
+        else
+        {
+            uint8 buffer[BufferSize];
+            return copy(in, out, buffer, sizeof(buffer), size);
+        }
     }
 }
 
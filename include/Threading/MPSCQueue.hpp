@@ -0,0 +1,75 @@
+#ifndef hpp_MPSCQueue_hpp
+#define hpp_MPSCQueue_hpp
+
+// We need types
+#include "Types.hpp"
+// We need atomic for the lock free queue
+#include <atomic>
+#include <cstddef>
+
+namespace Threading
+{
+    /** A bounded lock free queue with multiple producers and a single consumer.
+        Each cell has a sequence number telling if it's free for the producer reserving its position or filled for the consumer,
+        so a producer only contends on the tail index and the consumer never takes a lock.
+        There's no allocation here, the cells are allocated with the queue.
+        @param T        The type of the queued elements (it must be trivially copyable)
+        @param Size     The maximum number of queued elements (a power of 2) */
+    template <typename T, std::size_t Size>
+    struct MPSCQueue
+    {
+        static_assert(Size && !(Size & (Size - 1)), "The queue's size must be a power of 2");
+
+        /** Push an element in the queue (this can be called from any thread)
+            @return false if the queue is full */
+        bool push(const T & value)
+        {
+            std::size_t pos = tail.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell & cell = cells[pos & Mask];
+                const std::ptrdiff_t diff = (std::ptrdiff_t)cell.sequence.load(std::memory_order_acquire) - (std::ptrdiff_t)pos;
+                // The cell is free, try to reserve it
+                if (!diff) { if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break; }
+                // The cell wasn't consumed yet, so the queue is full
+                else if (diff < 0) return false;
+                // Another producer reserved it meanwhile
+                else pos = tail.load(std::memory_order_relaxed);
+            }
+            Cell & cell = cells[pos & Mask];
+            cell.value = value;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        /** Pop an element from the queue (this must only be called from the consumer's thread)
+            @return false if the queue is empty (or the next element isn't completely pushed yet) */
+        bool pop(T & value)
+        {
+            Cell & cell = cells[head & Mask];
+            if (cell.sequence.load(std::memory_order_acquire) != head + 1) return false;
+            value = cell.value;
+            // The cell is free for the producer that'll reserve it on the next turn
+            cell.sequence.store(head + Size, std::memory_order_release);
+            ++head;
+            return true;
+        }
+
+        MPSCQueue() { for (std::size_t i = 0; i < Size; i++) cells[i].sequence.store(i, std::memory_order_relaxed); }
+
+    private:
+        static constexpr std::size_t Mask = Size - 1;
+        struct Cell
+        {
+            std::atomic<std::size_t>    sequence;
+            T                           value;
+        };
+
+        Cell                                cells[Size];
+        /** The producers' position, on its own cache line so pushing doesn't slow down the consumer */
+        alignas(64) std::atomic<std::size_t> tail = 0;
+        /** The consumer's position */
+        alignas(64) std::size_t             head = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef hpp_WorkerPool_hpp
+#define hpp_WorkerPool_hpp
+
+// We need our configuration
+#include "HTTPDConfig.hpp"
+
+// We need threads and synchronization primitives
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+namespace Threading
+{
+    /** A fixed pool of worker threads.
+        Each worker has its own bounded task queue. Tasks are posted to the queues in round robin, and a worker whose queue
+        is empty steals the tasks from the other queues, so a long task doesn't delay the tasks posted after it.
+        There's no allocation here, the queues are allocated with the pool.
+        @param ThreadCount  The number of worker threads
+        @param QueueSize    The maximum number of pending tasks per worker */
+    template <std::size_t ThreadCount, std::size_t QueueSize = 16>
+    struct WorkerPool
+    {
+        /** A task to run in a worker thread */
+        struct Task
+        {
+            void (*func)(void * arg);
+            void * arg;
+        };
+
+        /** Post a task to the pool
+            @return false if all the queues are full (the task isn't run in that case) */
+        bool post(const Task & task)
+        {
+            std::size_t first = next.fetch_add(1, std::memory_order_relaxed);
+            for (std::size_t i = 0; i < ThreadCount; i++)
+            {
+                if (!queues[(first + i) % ThreadCount].push(task)) continue;
+                {
+                    std::lock_guard<std::mutex> lock(sleepLock);
+                    ++pending;
+                }
+                wakeUp.notify_one();
+                return true;
+            }
+            return false;
+        }
+
+        /** Start the worker threads (this is done upon construction) */
+        WorkerPool()
+        {
+            for (std::size_t i = 0; i < ThreadCount; i++)
+                workers[i] = std::thread(&WorkerPool::run, this, i);
+        }
+        /** Stop the worker threads, once all the pending tasks are done */
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepLock);
+                stopping = true;
+            }
+            wakeUp.notify_all();
+            for (std::size_t i = 0; i < ThreadCount; i++) workers[i].join();
+        }
+
+    private:
+        /** A bounded task queue, protected by its own lock */
+        struct Queue
+        {
+            std::mutex  lock;
+            Task        tasks[QueueSize];
+            std::size_t head = 0, count = 0;
+
+            bool push(const Task & task)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (count == QueueSize) return false;
+                tasks[(head + count++) % QueueSize] = task;
+                return true;
+            }
+            bool pop(Task & task)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!count) return false;
+                task = tasks[head];
+                head = (head + 1) % QueueSize; --count;
+                return true;
+            }
+        };
+
+        Queue                       queues[ThreadCount];
+        std::thread                 workers[ThreadCount];
+        std::atomic<std::size_t>    next = 0;
+        /** The number of tasks posted and not picked by a worker yet */
+        std::size_t                 pending = 0;
+        bool                        stopping = false;
+        std::mutex                  sleepLock;
+        std::condition_variable     wakeUp;
+
+        void run(const std::size_t index)
+        {
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(sleepLock);
+                    wakeUp.wait(lock, [this] { return pending || stopping; });
+                    if (!pending) return;
+                    // This worker is now responsible for one of the posted tasks
+                    --pending;
+                }
+                // Start with our own queue, then steal from the others. Since a pending task was reserved above, one is available
+                Task task;
+                for (std::size_t i = 0; ; i = (i + 1) % ThreadCount)
+                    if (queues[(index + i) % ThreadCount].pop(task)) break;
+                task.func(task.arg);
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <vector>
+
+// No log in this test, only the answers' system calls are checked
+#define SLog(level, ...) do {} while(0)
+#include "Network/Servers/HTTP.hpp"
+#include "Network/Servers/Route.hpp"
+
+// This test counts the system calls the server uses for sending an answer. The status line, headers and content of a small answer
+// are gathered, so they must be sent with a single call (or two with non blocking sockets, where an in place content is sent apart)
+// The send functions are replaced here, so the server's calls are counted (the test's client only uses write and recv)
+static int sendCalls = 0, zeroCopyCalls = 0;
+// The answer's size on the wire (head and encoded content)
+static std::size_t answerBytes = 0;
+extern "C" ssize_t send(int fd, const void * buffer, size_t length, int flags)
+{
+    ++sendCalls;
+#ifdef MSG_ZEROCOPY
+    if (flags & MSG_ZEROCOPY) ++zeroCopyCalls;
+#endif
+    return syscall(SYS_sendto, fd, buffer, length, flags, nullptr, 0);
+}
+extern "C" ssize_t sendmsg(int fd, const struct msghdr * message, int flags) { ++sendCalls; return syscall(SYS_sendmsg, fd, message, flags); }
+#if defined(__linux__)
+extern "C" ssize_t sendfile(int fd, int input, off_t * offset, size_t count) { ++sendCalls; return syscall(SYS_sendfile, fd, input, offset, count); }
+#endif
+
+using namespace Protocol::HTTP;
+using namespace Network::Servers::HTTP;
+
+static std::vector<char> largeContent(8192, 'x');
+auto Hello = [](Client & client, const auto & headers) { return client.reply(Code::Ok, "hello"); };
+auto Empty = [](Client & client, const auto & headers) { return client.reply(Code::NoContent); };
+// A message in the route's stack, it's copied if the socket doesn't accept it at once (with non blocking sockets)
+constexpr std::size_t LocalSize = 600;
+auto Local = [](Client & client, const auto & headers)
+{
+    char message[LocalSize];
+    memset(message, 'l', sizeof(message));
+    return client.reply(Code::Ok, ROString(message, sizeof(message)));
+};
+auto Large = [](Client & client, const auto & headers)
+{
+    FileAnswer<Streams::StaticView> answer("large.bin", ROString(largeContent.data(), largeContent.size()));
+    return client.sendAnswer(answer);
+};
+static char filePath[] = "/tmp/AnswerSyscallsXXXXXX";
+constexpr std::size_t FileSize = 65536;
+auto File = [](Client & client, const auto & headers)
+{
+    FileAnswer<Streams::FileDescInput> answer(filePath);
+    return client.sendAnswer(answer);
+};
+auto Mapped = [](Client & client, const auto & headers)
+{
+    FileAnswer<Streams::MappedFileInput> answer(filePath);
+    return client.sendAnswer(answer);
+};
+// A word by word answer, coalesced in a few chunks
+static const char loremIpsum[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. ";
+auto Long = [](Client & client, const auto & headers)
+{
+    // The callback owns its state, since it's called after the route returned if the answer is parked (with non blocking sockets)
+    CaptureAnswer answer{ Code::Ok, HeaderSet<Headers::ContentType>{ MIMEType::text_plain }, [text = ROString(loremIpsum)]() mutable { return text.splitFrom(" ", true); } };
+    return client.sendAnswer(answer);
+};
+// A larger word by word answer, sent in many chunks
+constexpr std::size_t RepeatCount = 256;
+auto Repeated = [](Client & client, const auto & headers)
+{
+    CaptureAnswer answer{ Code::Ok, HeaderSet<Headers::ContentType>{ MIMEType::text_plain }, [text = ROString(), count = RepeatCount]() mutable {
+        if (!text && count) { text = loremIpsum; --count; }
+        return text.splitFrom(" ", true);
+    } };
+    return client.sendAnswer(answer);
+};
+constexpr Router<Route<Hello, MethodsMask{Method::GET, Method::HEAD}, "/hello", Headers::Connection>{}, Route<Empty, MethodsMask{Method::GET}, "/empty", Headers::Connection>{},
+                 Route<Local, MethodsMask{Method::GET}, "/local", Headers::Connection>{},
+                 Route<Large, MethodsMask{Method::GET}, "/large", Headers::Connection>{}, Route<File, MethodsMask{Method::GET}, "/file", Headers::Connection>{},
+                 Route<Mapped, MethodsMask{Method::GET}, "/mapped", Headers::Connection>{}, Route<Long, MethodsMask{Method::GET}, "/long", Headers::Connection>{},
+                 Route<Repeated, MethodsMask{Method::GET}, "/repeated", Headers::Connection>{}> router;
+
+static Server<router, 4> server;
+constexpr uint16 Port = 8093;
+#if UseNonBlockingSocket == 1
+constexpr int MaxSmallAnswerCalls = 2;
+#else
+constexpr int MaxSmallAnswerCalls = 1;
+#endif
+// A short chunked answer is gathered with its head, whatever the number of pieces (or sent in a chunk per watermark)
+#if ChunkWatermark > 0
+constexpr int MaxChunkedAnswerCalls = 1 + (int)(sizeof(loremIpsum) / ChunkWatermark);
+#else
+constexpr int MaxChunkedAnswerCalls = 1;
+#endif
+// A larger chunked answer takes a call per chunk (of about a buffer, or the watermark)
+constexpr std::size_t MinChunkSize = ChunkWatermark > 0 && ChunkWatermark < ClientBufferSize / 2 ? ChunkWatermark : ClientBufferSize / 2;
+constexpr int MaxRepeatedAnswerCalls = 1 + (int)(RepeatCount * sizeof(loremIpsum) / MinChunkSize);
+// A mapped answer is sent with its head (or apart, in a few calls if the socket's buffer gets full with non blocking sockets)
+constexpr int MaxMappedAnswerCalls = UseNonBlockingSocket == 1 ? 8 : 1;
+#if defined(__linux__)
+// The head, then the file (in a few calls if the socket's buffer gets full with non blocking sockets)
+constexpr int MaxFileAnswerCalls = UseNonBlockingSocket == 1 ? 8 : 2;
+#else
+constexpr int MaxFileAnswerCalls = 1 + FileSize / (ClientBufferSize / 2);
+#endif
+
+/** Decode a chunked content
+    @return The content's length, or -1 if it isn't complete (or invalid) */
+static long decodeChunked(const char * content, std::size_t length)
+{
+    long total = 0;
+    std::size_t pos = 0;
+    while (pos < length)
+    {
+        char * end = nullptr;
+        const unsigned long size = strtoul(content + pos, &end, 16);
+        const std::size_t data = (std::size_t)(end - content) + 2;
+        if (end == content + pos || data + size + 2 > length) return -1;
+        if (!size) return data + 2 == length ? total : -1;
+        total += (long)size;
+        pos = data + size + 2;
+    }
+    return -1;
+}
+
+/** Send the request and serve it until the whole answer is received
+    @return The number of send calls for the answer, or -1 upon error */
+static int countAnswerCalls(const char * request, const char * expectedStatus, std::size_t expectedLength)
+{
+    // A HEAD answer has a Content-Length, but no content
+    const bool hasContent = strncmp(request, "HEAD", 4) != 0;
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(Port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) { ::close(fd); return -1; }
+    if (::write(fd, request, strlen(request)) != (ssize_t)strlen(request)) { ::close(fd); return -1; }
+
+    const int before = sendCalls;
+    std::vector<char> answer;
+    char buffer[4096];
+    std::size_t headLength = 0, contentLength = 0;
+    bool chunked = false;
+    for (int i = 0; i < 1000; i++)
+    {
+        server.loop(1);
+        ssize_t ret;
+        while ((ret = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) answer.insert(answer.end(), buffer, buffer + ret);
+        if (!headLength)
+        {
+            const char * end = answer.size() ? (const char*)memmem(answer.data(), answer.size(), "\r\n\r\n", 4) : nullptr;
+            if (!end) continue;
+            headLength = end + 4 - answer.data();
+            const char * length = (const char*)memmem(answer.data(), headLength, "Content-Length:", 15);
+            contentLength = length ? (std::size_t)atoi(length + 15) : 0;
+            chunked = memmem(answer.data(), headLength, "Transfer-Encoding:chunked", 25) != nullptr;
+        }
+        if (chunked)
+        {   // The chunked content ends with the last chunk
+            long decoded = decodeChunked(answer.data() + headLength, answer.size() - headLength);
+            if (decoded < 0) continue;
+            contentLength = (std::size_t)decoded;
+            break;
+        }
+        if (answer.size() >= headLength + (hasContent ? contentLength : 0)) break;
+    }
+    const int calls = sendCalls - before;
+    ::close(fd);
+    // Let the server close its side
+    server.loop(1);
+    answerBytes = answer.size();
+    if (!headLength || (!chunked && answer.size() != headLength + (hasContent ? contentLength : 0)) || contentLength != expectedLength || memcmp(answer.data(), expectedStatus, strlen(expectedStatus)))
+    {
+        fprintf(stderr, "Unexpected answer for %.*s: %.*s\n", (int)(strchr(request, '\r') - request), request, (int)min(answer.size(), (std::size_t)200), answer.data());
+        return -1;
+    }
+    return calls;
+}
+
+static bool check(const char * request, const char * expectedStatus, std::size_t expectedLength, int maxCalls)
+{
+    int calls = countAnswerCalls(request, expectedStatus, expectedLength);
+    printf("%-60.*s %d send calls, %u bytes\n", (int)(strchr(request, '\r') - request), request, calls, (unsigned)answerBytes);
+    if (calls < 0 || calls > maxCalls)
+    {
+        fprintf(stderr, "Failed test for %.*s: %d send calls, expected at most %d\n", (int)(strchr(request, '\r') - request), request, calls, maxCalls);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    if (server.create(Port).isError()) { fprintf(stderr, "Can't listen on port %u\n", (unsigned)Port); return 1; }
+
+    if (!check("GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", 5, MaxSmallAnswerCalls)) return 1;
+    if (!check("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", "HTTP/1.1 200 Ok\r\n", 5, MaxSmallAnswerCalls)) return 1;
+    if (!check("HEAD /hello HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", 5, 1)) return 1;
+    if (!check("GET /local HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", LocalSize, MaxSmallAnswerCalls)) return 1;
+    if (!check("GET /empty HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 204 No Content\r\n", 0, 1)) return 1;
+    if (!check("GET /missing HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 404 Not Found\r\n", 0, 1)) return 1;
+    // A large in memory answer is sent from its mapping, along with the head
+    if (!check("GET /large HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", largeContent.size(), MaxSmallAnswerCalls)) return 1;
+
+    // A chunked answer's pieces are coalesced and sent with the head, instead of a chunk per piece
+    if (!check("GET /long HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", strlen(loremIpsum), MaxChunkedAnswerCalls)) return 1;
+    if (!check("GET /repeated HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", RepeatCount * strlen(loremIpsum), MaxRepeatedAnswerCalls)) return 1;
+
+    // A file descriptor stream is sent with sendfile after the head, instead of a send per buffer
+    int fd = mkstemp(filePath);
+    if (fd < 0 || ftruncate(fd, FileSize) < 0) { fprintf(stderr, "Can't create %s\n", filePath); return 1; }
+    ::close(fd);
+    bool sent = check("GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", FileSize, MaxFileAnswerCalls);
+    // A mapped file is sent from its mapping, along with the head
+    sent = sent && check("GET /mapped HTTP/1.1\r\nHost: localhost\r\n\r\n", "HTTP/1.1 200 Ok\r\n", FileSize, MaxMappedAnswerCalls);
+#if UseZeroCopySend == 1
+    // Only the large mapped answers are sent without copying
+    printf("Zero copy sends: %d\n", zeroCopyCalls);
+    if (sent && zeroCopyCalls < 1) { fprintf(stderr, "Failed test: the mapped file wasn't sent with MSG_ZEROCOPY\n"); sent = false; }
+#endif
+    unlink(filePath);
+    return sent ? 0 : 1;
+}
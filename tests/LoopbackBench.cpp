@@ -0,0 +1,606 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <signal.h>
+
+// No log in this benchmark, it would only measure the console speed
+#define SLog(level, ...) do {} while(0)
+#include "Network/Servers/HTTP.hpp"
+#include "Network/Servers/Route.hpp"
+#include "Network/Servers/MultiServer.hpp"
+#if UseServerStats == 1
+  #include "Network/Servers/PreforkServer.hpp"
+#endif
+#if defined(__linux__)
+  #include "Network/Servers/URingServer.hpp"
+  #include <sys/epoll.h>
+#endif
+#include <netinet/tcp.h>
+
+// This benchmark runs the server in a thread and a loopback HTTP client in the main thread, with many keep-alive connections sending
+// small requests as fast as possible. It's used to compare the different server engines.
+// The multi engine runs one server per thread (and the client side is spread on as many threads too), so the scaling with cores can be checked
+// The prefork engine runs one server per worker process (only if UseServerStats is 1), the workers' counters are printed at the end
+// The external engine drives the server from the application's own epoll loop (see ExternalSocketPool)
+// The heavy connections are requesting a slow route meanwhile (their requests aren't measured), to check how the other clients are impacted
+// (or downloading a large answer with -download=bytes)
+// The burst mode opens all the connections at once, sends a single request on each and waits for all the answers, in rounds, so it measures
+// the connection setup rate and latency (from the connect call to the answer) instead
+// The overload mode is a burst mode on a server with only OverloadClients clients, with factor times more connections (the 503 answers
+// are counted apart, so the latency is only measured for the admitted requests), while half of the clients are kept alive connections
+// sending requests continuously (their latency is reported too)
+// The listening socket's options can be given anywhere on the command line, to measure their impact on the latency
+// Usage: LoopbackBench [select|epoll|uring|external|multi|prefork] [connections] [seconds] [port] [threads] [heavy connections]
+//        LoopbackBench burst [select|epoll|uring|multi] [connections] [seconds] [port]
+//        LoopbackBench overload [select|epoll|uring] [factor] [seconds] [port]
+// Options: -nodelay=0|1 -defer=seconds -fastopen=queue -rcvbuf=bytes -sndbuf=bytes -backlog=count
+//          -unix=1 (listen on a Unix domain socket instead of the TCP loopback)
+//          -spin=us (the server's loop spins for this idle time before blocking) -busypoll=us (SO_BUSY_POLL on the server's sockets)
+//          -download=bytes (the heavy connections download an answer of this size instead)
+//          -fromfile=1|2|3 (the download is a temporary file, read in the client's buffer (1), sent from its descriptor with sendfile (2)
+//          or sent from its mapping (3))
+//          The server's CPU time per GiB downloaded is reported too (for the single threaded engines)
+//          -rate=bytes/s (each download is shaped to this rate) -globalrate=bytes/s (all downloads share this rate, 0 for no limit)
+//          The downloads' achieved rate is reported, to check the shapers' accuracy (and their overhead with -globalrate=0)
+//          -idle=count (this many kept alive connections stay idle after their first request, the number of them closed by the server
+//          is reported in burst and overload modes. With many idle connections, the loop's cost of scanning the clients is measured)
+
+using namespace Protocol::HTTP;
+using namespace Network::Servers::HTTP;
+
+auto Hello = [](Client & client, const auto &) { return client.reply(Code::Ok, "hello"); };
+// A slow route, simulating a long processing (like a firmware upload)
+#if UseCoroutineRoutes == 1
+// As a coroutine, the server serves the other clients while it waits
+auto Heavy = [](Client & client, const auto &) -> RouteTask { co_await sleepFor(20); co_return client.reply(Code::Ok, "heavy"); };
+#else
+auto Heavy = [](Client & client, const auto &) { std::this_thread::sleep_for(std::chrono::milliseconds(20)); return client.reply(Code::Ok, "heavy"); };
+#endif
+// A large download
+static std::vector<char> largeContent;
+#if UseEgressShaping == 1
+static uint32 downloadRate = 0;
+static int globalRate = -1;
+#endif
+static int downloadFrom = 0;
+static char downloadPath[] = "/tmp/LoopbackBenchXXXXXX";
+auto Large = [](Client & client, const auto &)
+{
+#if UseEgressShaping == 1
+    if (downloadRate || globalRate >= 0) client.shapeAnswer(downloadRate, globalRate >= 0);
+#endif
+    if (downloadFrom == 1)
+    {
+        FileAnswer<Streams::FileInput> answer(downloadPath);
+        return client.sendAnswer(answer);
+    }
+    if (downloadFrom == 2)
+    {
+        FileAnswer<Streams::FileDescInput> answer(downloadPath);
+        return client.sendAnswer(answer);
+    }
+    if (downloadFrom == 3)
+    {
+        FileAnswer<Streams::MappedFileInput> answer(downloadPath);
+        return client.sendAnswer(answer);
+    }
+    FileAnswer<Streams::StaticView> answer("large.bin", ROString(largeContent.data(), largeContent.size()));
+    return client.sendAnswer(answer);
+};
+#if UseRouteOffloading == 1 && UseCoroutineRoutes == 0
+constexpr Router<Route<Hello, MethodsMask{Method::GET}, "/hello", Headers::Connection>{}, Route<Offload<Heavy>{}, MethodsMask{Method::GET}, "/heavy", Headers::Connection>{},
+                 Route<Large, MethodsMask{Method::GET}, "/large", Headers::Connection>{}> router;
+#else
+constexpr Router<Route<Hello, MethodsMask{Method::GET}, "/hello", Headers::Connection>{}, Route<Heavy, MethodsMask{Method::GET}, "/heavy", Headers::Connection>{},
+                 Route<Large, MethodsMask{Method::GET}, "/large", Headers::Connection>{}> router;
+#endif
+
+constexpr std::size_t MaxClients = 1024;
+static std::atomic<bool> running = true;
+static std::thread serverThread;
+// The answers' parts aren't delayed by Nagle's algorithm (-nodelay=0 measures it)
+static Network::ListenOptions listenOptions = [] { Network::ListenOptions options; options.noDelay = true; return options; }();
+static bool useUnixSocket = false;
+static uint32 spinIdleUs = 0;
+static int idleCount = 0;
+static char unixPath[32];
+
+template <typename T>
+static bool runServer(T & server, uint16 port)
+{
+    if (server.create(port, listenOptions).isError()) return false;
+    server.busyPollIdleUs = spinIdleUs;
+    serverThread = std::thread([&server]() { while (running) server.loop(); });
+    return true;
+}
+
+static Server<router, MaxClients, Network::SelectSocketPool> selectServer;
+#if defined(__linux__)
+static Server<router, MaxClients, Network::EPollSocketPool> epollServer;
+static URingServer<router, MaxClients> uringServer;
+static Server<router, MaxClients, Network::ExternalSocketPool> externalServer;
+
+// The application's loop, owning the epoll instance, updates its registrations when the server changes a socket's interest
+static bool runExternalServer(uint16 port)
+{
+    int host = ::epoll_create1(EPOLL_CLOEXEC);
+    if (host == -1) return false;
+    externalServer.pool.opaque = (void*)(intptr_t)host;
+    externalServer.pool.onInterest = [](void * opaque, int fd, void * cookie, bool reading, bool writing)
+    {
+        epoll_event ev = {};
+        ev.events = (reading ? (uint32)EPOLLIN : 0) | (writing ? (uint32)EPOLLOUT : 0);
+        ev.data.ptr = cookie;
+        if (!reading && !writing) ::epoll_ctl((int)(intptr_t)opaque, EPOLL_CTL_DEL, fd, nullptr);
+        else if (::epoll_ctl((int)(intptr_t)opaque, EPOLL_CTL_MOD, fd, &ev) != 0) ::epoll_ctl((int)(intptr_t)opaque, EPOLL_CTL_ADD, fd, &ev);
+    };
+    if (externalServer.create(port, listenOptions).isError()) return false;
+    serverThread = std::thread([host]()
+    {
+        epoll_event events[64];
+        while (running)
+        {
+            int count = ::epoll_wait(host, events, 64, (int)externalServer.nextDeadline(20));
+            for (int i = 0; i < count; i++)
+            {
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) externalServer.onReadable(events[i].data.ptr);
+                if (events[i].events & EPOLLOUT) externalServer.onWritable(events[i].data.ptr);
+            }
+            externalServer.onTimer();
+        }
+        ::close(host);
+    });
+    return true;
+}
+#endif
+static MultiServer<router, MaxClients, 16> multiServer;
+#if UseServerStats == 1
+static PreforkServer<router, MaxClients, 16> preforkServer;
+#endif
+// The small servers for the overload mode
+constexpr std::size_t OverloadClients = 16;
+static Server<router, OverloadClients, Network::SelectSocketPool> selectSmallServer;
+#if defined(__linux__)
+static Server<router, OverloadClients, Network::EPollSocketPool> epollSmallServer;
+static URingServer<router, OverloadClients> uringSmallServer;
+#endif
+
+// The client side
+// The server's address, on the TCP loopback or on a Unix domain socket (in the abstract namespace)
+struct ServerAddress
+{
+    sockaddr_storage storage = {};
+    socklen_t length = 0;
+
+    const sockaddr * get() const { return (const sockaddr*)&storage; }
+    int family() const { return storage.ss_family; }
+    ServerAddress(uint16 port)
+    {
+        if (useUnixSocket)
+        {
+            sockaddr_un & address = (sockaddr_un&)storage;
+            address.sun_family = AF_UNIX;
+            // The abstract namespace starts with a zero byte instead of the '@'
+            std::size_t size = strlen(unixPath);
+            memcpy(address.sun_path + 1, unixPath + 1, size - 1);
+            length = (socklen_t)(offsetof(sockaddr_un, sun_path) + size);
+            return;
+        }
+        sockaddr_in & address = (sockaddr_in&)storage;
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        length = sizeof(address);
+    }
+};
+static void setClientOptions(int fd)
+{
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef TCP_FASTOPEN_CONNECT
+    // Send the request in the SYN packet when the server accepts it
+    if (listenOptions.fastOpenQueue) ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+#endif
+}
+
+static const char helloRequest[] = "GET /hello HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+static const char heavyRequest[] = "GET /heavy HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+static const char largeRequest[] = "GET /large HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+static const char closeRequest[] = "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n";
+struct BenchConnection
+{
+    const char * request = helloRequest;
+    int fd = -1;
+    std::size_t received = 0, expected = 0;
+    char buffer[512];
+    std::chrono::steady_clock::time_point start;
+
+    bool send()
+    {
+        received = expected = 0;
+        start = std::chrono::steady_clock::now();
+        std::size_t length = strlen(request);
+        return ::send(fd, request, length, MSG_NOSIGNAL) == (ssize_t)length;
+    }
+    // Returns 1 if a complete answer was received, 0 if more data is needed, -1 on error
+    int receive()
+    {
+        // Once the headers are parsed, the content is only counted
+        ssize_t ret = expected ? ::recv(fd, buffer, sizeof(buffer), 0) : ::recv(fd, buffer + received, sizeof(buffer) - received - 1, 0);
+        if (ret <= 0) return -1;
+        received += ret;
+        if (!expected)
+        {
+            buffer[received] = 0;
+            const char * end = strstr(buffer, "\r\n\r\n");
+            if (!end) return 0;
+            const char * length = strcasestr(buffer, "Content-Length:");
+            expected = (end - buffer) + 4 + (length ? strtoul(length + 15, 0, 10) : 0);
+        }
+        return received >= expected ? 1 : 0;
+    }
+};
+
+// A client thread, driving its own connections
+struct ClientThread
+{
+    int connectionCount = 0;
+    const char * request = helloRequest;
+    std::vector<uint32_t> latencies;
+    std::size_t errors = 0, bytes = 0;
+
+    void run(uint16 port, std::chrono::steady_clock::time_point stop)
+    {
+        int poller = epoll_create1(0);
+        std::vector<BenchConnection> connections(connectionCount);
+        ServerAddress address(port);
+        for (BenchConnection & conn : connections)
+        {
+            conn.request = request;
+            conn.fd = ::socket(address.family(), SOCK_STREAM, 0);
+            setClientOptions(conn.fd);
+            if (::connect(conn.fd, address.get(), address.length) < 0) { ++errors; return; }
+            epoll_event ev = { EPOLLIN, { .ptr = &conn } };
+            epoll_ctl(poller, EPOLL_CTL_ADD, conn.fd, &ev);
+        }
+
+        latencies.reserve(1 << 20);
+        for (BenchConnection & conn : connections) conn.send();
+
+        epoll_event events[MaxClients];
+        while (std::chrono::steady_clock::now() < stop)
+        {
+            int count = epoll_wait(poller, events, MaxClients, 100);
+            auto now = std::chrono::steady_clock::now();
+            for (int i = 0; i < count; i++)
+            {
+                BenchConnection & conn = *(BenchConnection*)events[i].data.ptr;
+                std::size_t before = conn.received;
+                int ret = conn.receive();
+                if (ret < 0) { ++errors; epoll_ctl(poller, EPOLL_CTL_DEL, conn.fd, 0); continue; }
+                bytes += conn.received - before;
+                if (ret == 0) continue;
+                latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - conn.start).count());
+                if (!conn.send()) ++errors;
+            }
+        }
+        for (BenchConnection & conn : connections) ::close(conn.fd);
+        ::close(poller);
+    }
+};
+
+// The burst client, opening all its connections at once in each round
+struct BurstClient
+{
+    int connectionCount = 0;
+    std::vector<uint32_t> latencies;
+    std::size_t errors = 0, rounds = 0, unavailable = 0;
+
+    void run(uint16 port, std::chrono::steady_clock::time_point stop)
+    {
+        int poller = epoll_create1(0);
+        ServerAddress address(port);
+        epoll_event events[MaxClients];
+        while (std::chrono::steady_clock::now() < stop)
+        {
+            std::vector<BenchConnection> connections(connectionCount);
+            for (BenchConnection & conn : connections)
+            {
+                conn.request = closeRequest;
+                conn.start = std::chrono::steady_clock::now();
+                conn.fd = ::socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK, 0);
+                setClientOptions(conn.fd);
+                if (::connect(conn.fd, address.get(), address.length) < 0 && errno != EINPROGRESS) { ++errors; ::close(conn.fd); conn.fd = -1; continue; }
+                // Wait for the connection to be established before sending the request
+                epoll_event ev = { EPOLLOUT, { .ptr = &conn } };
+                epoll_ctl(poller, EPOLL_CTL_ADD, conn.fd, &ev);
+            }
+            // Give up on the connections that take more than 5s (they are counted as errors)
+            std::size_t pending = connectionCount;
+            auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (pending && std::chrono::steady_clock::now() < giveUp)
+            {
+                int count = epoll_wait(poller, events, MaxClients, 100);
+                auto now = std::chrono::steady_clock::now();
+                for (int i = 0; i < count; i++)
+                {
+                    BenchConnection & conn = *(BenchConnection*)events[i].data.ptr;
+                    int ret = -1;
+                    if (events[i].events & EPOLLOUT)
+                    {   // Connected (or failed), send the request while keeping the connection's start time
+                        int error = 0; socklen_t len = sizeof(error);
+                        auto start = conn.start;
+                        if (!::getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len) && !error && conn.send())
+                        {
+                            conn.start = start;
+                            epoll_event ev = { EPOLLIN, { .ptr = &conn } };
+                            epoll_ctl(poller, EPOLL_CTL_MOD, conn.fd, &ev);
+                            continue;
+                        }
+                    }
+                    else if ((ret = conn.receive()) == 0) continue;
+
+                    if (ret < 0) ++errors;
+                    else if (!strncmp(conn.buffer, "HTTP/1.1 503", 12)) ++unavailable;
+                    else latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - conn.start).count());
+                    ::close(conn.fd); conn.fd = -1;
+                    --pending;
+                }
+            }
+            for (BenchConnection & conn : connections) if (conn.fd != -1) { ++errors; ::close(conn.fd); }
+            ++rounds;
+        }
+        ::close(poller);
+    }
+};
+
+static bool startServer(const char * engine, uint16 port, int threadCount, bool small = false)
+{
+    if (useUnixSocket)
+    {
+        snprintf(unixPath, sizeof(unixPath), "@LoopbackBench%u", (unsigned)port);
+        listenOptions.unixPath = unixPath;
+    }
+    if (!strcmp(engine, "select")) return small ? runServer(selectSmallServer, port) : runServer(selectServer, port);
+#if defined(__linux__)
+    if (!strcmp(engine, "epoll")) return small ? runServer(epollSmallServer, port) : runServer(epollServer, port);
+    if (!strcmp(engine, "uring")) return small ? runServer(uringSmallServer, port) : runServer(uringServer, port);
+    if (!strcmp(engine, "external") && !small) return runExternalServer(port);
+#endif
+    if (!strcmp(engine, "multi"))
+    {
+        for (auto & server : multiServer.servers) server.busyPollIdleUs = spinIdleUs;
+        return multiServer.create(port, threadCount, listenOptions) == Network::Success;
+    }
+#if UseServerStats == 1
+    if (!strcmp(engine, "prefork"))
+    {
+        // Fork before any client thread is started, and supervise the workers from a thread meanwhile
+        if (preforkServer.create(port, threadCount, listenOptions) != Network::Success) return false;
+        serverThread = std::thread([]() { while (running) { preforkServer.supervise(); std::this_thread::sleep_for(std::chrono::milliseconds(100)); } });
+        return true;
+    }
+#endif
+    fprintf(stderr, "Unknown engine: %s\n", engine);
+    return false;
+}
+
+// The CPU time used by the server's thread in seconds, or -1 if the server doesn't run in a single thread
+static double getServerCpuTime(const char * engine)
+{
+    clockid_t clock;
+    struct timespec t;
+    if (!strcmp(engine, "prefork") || !serverThread.joinable()) return -1;
+    if (pthread_getcpuclockid(serverThread.native_handle(), &clock) != 0 || clock_gettime(clock, &t) != 0) return -1;
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void stopServer()
+{
+    running = false;
+    if (serverThread.joinable()) serverThread.join();
+    multiServer.stop();
+#if UseServerStats == 1
+    if (preforkServer.isRunning())
+    {
+        auto & stats = *preforkServer.stats;
+        printf("workers: %zu  accepted: %llu  requests: %llu  timed out: %llu  restarts: %u\n", preforkServer.workerCount,
+               (unsigned long long)stats.total(&ServerStats::accepted), (unsigned long long)stats.total(&ServerStats::requests),
+               (unsigned long long)stats.total(&ServerStats::timedOut), (unsigned)stats.restarts.load());
+        preforkServer.stop();
+    }
+#endif
+}
+
+static std::size_t percentile(const std::vector<uint32_t> & latencies, double p) { return latencies.size() ? latencies[std::min(latencies.size() - 1, (std::size_t)(p * latencies.size()))] : 0; }
+
+// Open the given number of kept alive connections, each sending a single request before staying idle
+static std::vector<int> openIdleConnections(uint16 port, int count)
+{
+    std::vector<int> fds;
+    ServerAddress address(port);
+    for (int i = 0; i < count; i++)
+    {
+        BenchConnection conn;
+        conn.fd = ::socket(address.family(), SOCK_STREAM, 0);
+        setClientOptions(conn.fd);
+        // Without a free slot, the answer never comes
+        timeval timeout = { 1, 0 };
+        ::setsockopt(conn.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (::connect(conn.fd, address.get(), address.length) < 0 || !conn.send()) { ::close(conn.fd); break; }
+        int ret;
+        while (!(ret = conn.receive())) {}
+        if (ret < 0) { ::close(conn.fd); break; }
+        fds.push_back(conn.fd);
+    }
+    return fds;
+}
+// Count the idle connections the server closed
+static std::size_t closeIdleConnections(const std::vector<int> & fds)
+{
+    std::size_t closed = 0;
+    char c;
+    for (int fd : fds)
+    {
+        if (::recv(fd, &c, 1, MSG_DONTWAIT) == 0) ++closed;
+        ::close(fd);
+    }
+    return closed;
+}
+
+static int runBurst(int argc, char ** argv, bool overload)
+{
+    const char * engine = argc > 2 ? argv[2] : "select";
+    int connectionCount = argc > 3 ? atoi(argv[3]) : overload ? 10 : 128;
+    int duration = argc > 4 ? atoi(argv[4]) : 3;
+    uint16 port = argc > 5 ? (uint16)atoi(argv[5]) : 8090;
+    if (overload) connectionCount *= (int)OverloadClients;
+    if (connectionCount < 1 || connectionCount > (int)(overload ? 64 * OverloadClients : MaxClients)) { fprintf(stderr, "Connections (or factor) out of range\n"); return 1; }
+
+    if (!startServer(engine, port, 0, overload)) { fprintf(stderr, "Can't start the %s server on port %u\n", engine, (unsigned)port); return 1; }
+    std::vector<int> idleConnections = openIdleConnections(port, idleCount);
+    BurstClient client;
+    client.connectionCount = connectionCount;
+    auto begin = std::chrono::steady_clock::now();
+    ClientThread keptAlive;
+    std::thread keptAliveThread;
+    if (overload)
+    {
+        keptAlive.connectionCount = OverloadClients / 2;
+        keptAliveThread = std::thread([&]() { keptAlive.run(port, begin + std::chrono::seconds(duration)); });
+        // Let them connect first
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    client.run(port, begin + std::chrono::seconds(duration));
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (keptAliveThread.joinable()) keptAliveThread.join();
+    std::size_t idleClosed = closeIdleConnections(idleConnections);
+    stopServer();
+
+    std::sort(client.latencies.begin(), client.latencies.end());
+    printf("%s %-7s connections: %4d  rounds: %6zu  conn/s: %10.0f  p50: %6zuus  p99: %6zuus  max: %8zuus  503: %zu  errors: %zu\n",
+           overload ? "overload" : "burst", engine, connectionCount, client.rounds, client.latencies.size() / elapsed, percentile(client.latencies, 0.5),
+           percentile(client.latencies, 0.99), client.latencies.size() ? (std::size_t)client.latencies.back() : 0, client.unavailable, client.errors);
+    if (idleConnections.size()) printf("idle             connections: %4zu  closed by the server: %zu\n", idleConnections.size(), idleClosed);
+    if (overload)
+    {
+        std::sort(keptAlive.latencies.begin(), keptAlive.latencies.end());
+        printf("kept alive       connections: %4d  requests: %8zu  p50: %6zuus  p99: %6zuus  errors: %zu\n", keptAlive.connectionCount, keptAlive.latencies.size(),
+               percentile(keptAlive.latencies, 0.5), percentile(keptAlive.latencies, 0.99), keptAlive.errors);
+    }
+    return client.errors || keptAlive.errors ? 1 : 0;
+}
+
+// Write the download's content to a temporary file
+static bool writeDownloadFile()
+{
+    int fd = mkstemp(downloadPath);
+    if (fd < 0) return false;
+    bool done = ::write(fd, largeContent.data(), largeContent.size()) == (ssize_t)largeContent.size();
+    ::close(fd);
+    return done;
+}
+
+// Extract the listening socket's options from the arguments
+// Returns the number of remaining arguments or -1 for an unknown option
+static int parseListenOptions(int argc, char ** argv)
+{
+    int count = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        const char * value = argv[i][0] == '-' ? strchr(argv[i], '=') : 0;
+        if (!value) { argv[count++] = argv[i]; continue; }
+        int n = atoi(value + 1);
+        auto is = [&](const char * name) { return strlen(name) == (std::size_t)(value - argv[i]) && !strncmp(argv[i], name, value - argv[i]); };
+        if (is("-nodelay")) listenOptions.noDelay = n != 0;
+        else if (is("-defer")) listenOptions.deferAcceptSec = n;
+        else if (is("-fastopen")) listenOptions.fastOpenQueue = n;
+        else if (is("-rcvbuf")) listenOptions.receiveBufferSize = n;
+        else if (is("-sndbuf")) listenOptions.sendBufferSize = n;
+        else if (is("-backlog")) listenOptions.backlog = n;
+        else if (is("-unix")) useUnixSocket = n != 0;
+        else if (is("-spin")) spinIdleUs = (uint32)n;
+        else if (is("-busypoll")) listenOptions.busyPollUs = n;
+        else if (is("-download")) largeContent.assign((std::size_t)n, 'x');
+        else if (is("-idle")) idleCount = n;
+        else if (is("-fromfile")) downloadFrom = n;
+#if UseEgressShaping == 1
+        else if (is("-rate")) downloadRate = (uint32)n;
+        else if (is("-globalrate")) Client::setGlobalSendRate((uint32)(globalRate = n));
+#endif
+        else { fprintf(stderr, "Unknown option: %s\n", argv[i]); return -1; }
+    }
+    return count;
+}
+
+int main(int argc, char ** argv)
+{
+    // The client closes its connections while the server might still be answering
+    signal(SIGPIPE, SIG_IGN);
+    if ((argc = parseListenOptions(argc, argv)) < 0) return 1;
+    if (argc > 1 && !strcmp(argv[1], "burst")) return runBurst(argc, argv, false);
+    if (argc > 1 && !strcmp(argv[1], "overload")) return runBurst(argc, argv, true);
+
+    const char * engine = argc > 1 ? argv[1] : "select";
+    int connectionCount = argc > 2 ? atoi(argv[2]) : 64;
+    int duration = argc > 3 ? atoi(argv[3]) : 3;
+    uint16 port = argc > 4 ? (uint16)atoi(argv[4]) : 8090;
+    int threadCount = argc > 5 ? atoi(argv[5]) : 1;
+    int heavyCount = argc > 6 ? atoi(argv[6]) : 0;
+    if (threadCount < 1 || threadCount > 16 || threadCount > connectionCount) { fprintf(stderr, "Threads must be in [1 16] and less than connections\n"); return 1; }
+    if (connectionCount < 1 || connectionCount + heavyCount + idleCount > (int)MaxClients) { fprintf(stderr, "Connections (including heavy and idle) must be in [1 %u]\n", (unsigned)MaxClients); return 1; }
+    if (downloadFrom && !writeDownloadFile()) { fprintf(stderr, "Can't write the download's file\n"); return 1; }
+
+    if (!startServer(engine, port, threadCount)) { fprintf(stderr, "Can't start the %s server on port %u\n", engine, (unsigned)port); return 1; }
+    std::vector<int> idleConnections = openIdleConnections(port, idleCount);
+
+    // Spread the connections on the client threads
+    ClientThread clients[16];
+    std::thread clientThreads[16];
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < threadCount; i++)
+    {
+        clients[i].connectionCount = connectionCount / threadCount + (i < connectionCount % threadCount);
+        clientThreads[i] = std::thread([&, i]() { clients[i].run(port, begin + std::chrono::seconds(duration)); });
+    }
+    ClientThread heavyClients;
+    std::thread heavyThread;
+    if (heavyCount)
+    {
+        heavyClients.connectionCount = heavyCount;
+        heavyClients.request = largeContent.size() ? largeRequest : heavyRequest;
+        heavyThread = std::thread([&]() { heavyClients.run(port, begin + std::chrono::seconds(duration)); });
+    }
+    std::vector<uint32_t> latencies;
+    std::size_t errors = 0;
+    if (heavyThread.joinable()) { heavyThread.join(); errors += heavyClients.errors; }
+    for (int i = 0; i < threadCount; i++)
+    {
+        clientThreads[i].join();
+        latencies.insert(latencies.end(), clients[i].latencies.begin(), clients[i].latencies.end());
+        errors += clients[i].errors;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    closeIdleConnections(idleConnections);
+    const double serverCpu = getServerCpuTime(engine);
+    stopServer();
+    if (downloadFrom) unlink(downloadPath);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-7s threads: %2d  connections: %4d  heavy: %2d (%zu)  requests: %8zu  req/s: %10.0f  p50: %6zuus  p99: %6zuus  errors: %zu\n",
+           engine, threadCount, connectionCount, heavyCount, heavyClients.latencies.size(), latencies.size(), latencies.size() / elapsed, percentile(latencies, 0.5), percentile(latencies, 0.99), errors);
+    if (heavyCount && largeContent.size())
+    {
+        printf("downloads: %10.0f B/s  per connection: %10.0f B/s", heavyClients.bytes / elapsed, heavyClients.bytes / elapsed / heavyCount);
+        // This includes the small requests' processing, so use few connections for measuring the downloads' cost
+        if (serverCpu >= 0 && heavyClients.bytes) printf("  server CPU: %7.1f ms/GiB", serverCpu * 1000 * (1 << 30) / heavyClients.bytes);
+        printf("\n");
+    }
+    if (idleCount) printf("idle connections: %zu\n", idleConnections.size());
+    return errors ? 1 : 0;
+}
@@ -68,7 +68,7 @@ auto LongAnswer = [](Client & client, const auto & headers)
         Code::Ok,
         // Using initializer list here for each given type if any of them requires multiple value, else you can use the value directly
         HeaderSet<Headers::ContentType, Headers::ContentLanguage>{ { MIMEType::text_plain }, { expected, Language::fr } },
-        [&]() { return longText.splitFrom(" ", true); }  // Give a word by word answer, this will be called as many times as there are words in the answer, sending a chunk each time
+        [longText]() mutable { return longText.splitFrom(" ", true); }  // Give a word by word answer, this will be called as many times as there are words in the answer, the words being coalesced in a few chunks (see ChunkWatermark)
     };
     // Another possibility to set the header
     // answer.template setHeader<Headers::ContentType>(MIMEType::text_plain);
@@ -103,10 +103,10 @@ auto CatchAll = [](Client & client, const auto & headers)
     memcpy(buffer + cwdLen, path.getData(), path.getLength());
     buffer[cwdLen + path.getLength()] = 0;
 
-    // Ok, make an FileAnswer that'll copy the file content to the send buffer repeatedly until done.
-    // You might prefer to use memory mapping here, which is also possible, with a Stream::MemoryView instead
-    // This server doesn't use linux's sendfile syscall, it's too specific to Linux.
-    FileAnswer<Streams::FileInput> answer(buffer);
+    // Ok, make an FileAnswer that'll send the file content. With a file descriptor stream, it's sent with linux's sendfile syscall, so
+    // it's not copied to the send buffer (on other platforms, or with TLS, it's read in the send buffer repeatedly until done).
+    // You might prefer to use memory mapping here, which is also possible, with a Streams::MappedFileInput instead (it's sent from the mapping)
+    FileAnswer<Streams::FileDescInput> answer(buffer);
 //    FileAnswer<Streams::MemoryView, Headers::ContentEncoding> answer((const char*)buffer, ROString("This is it"));
 //    answer.setHeader<Headers::ContentEncoding>(Encoding::identity);
     return client.sendAnswer(answer);
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// We are testing the timer wheel used for the clients' deadlines
+#include "Container/TimerWheel.hpp"
+
+typedef Container::TimerWheel<64> Wheel;
+
+// The expected deadline for each timer (or 0 if not scheduled) and when it expired
+struct Expect
+{
+    uint32 deadline[64];
+    bool   scheduled[64];
+    uint32 expiredAt[64];
+    bool   expired[64];
+};
+
+bool isAfter(const uint32 a, const uint32 b) { return (int32)(a - b) > 0; }
+
+bool testEqual(const uint32 a, const uint32 b, const char * what, const uint32 i)
+{
+    if (a != b)
+    {
+        fprintf(stderr, "Failed test for %s (%u), expected %u, got %u\n", what, i, a, b);
+        return false;
+    }
+    return true;
+}
+
+// Advance the wheel up to the given time, waking up when nextDelay says so, and check each timer expires right on its deadline
+bool runUntil(Wheel & wheel, Expect & expect, uint32 & now, const uint32 end)
+{
+    while (isAfter(end, now))
+    {
+        uint32 delay = wheel.nextDelay(now, end - now);
+        // The wheel must never wake up after a deadline
+        for (uint32 i = 0; i < 64; i++)
+            if (expect.scheduled[i] && isAfter(now + delay, expect.deadline[i]) && !isAfter(now, expect.deadline[i]))
+            {
+                fprintf(stderr, "Failed test for next delay (%u), at %u: %u, deadline is %u\n", i, now, delay, expect.deadline[i]);
+                return false;
+            }
+        now += delay;
+        wheel.advance(now, [&](uint32 index) { expect.expiredAt[index] = now; expect.expired[index] = true; expect.scheduled[index] = false; });
+        for (uint32 i = 0; i < 64; i++)
+        {
+            if (expect.expired[i] && !testEqual(expect.deadline[i], expect.expiredAt[i], "expiration time", i)) return false;
+            expect.expired[i] = false;
+            if (expect.scheduled[i] && !isAfter(expect.deadline[i], now))
+            {
+                fprintf(stderr, "Failed test for missed deadline (%u), at %u, deadline is %u\n", i, now, expect.deadline[i]);
+                return false;
+            }
+        }
+        if (!delay) ++now;
+    }
+    return true;
+}
+
+bool schedule(Wheel & wheel, Expect & expect, const uint32 index, const uint32 deadline)
+{
+    wheel.schedule(index, deadline);
+    expect.deadline[index] = deadline;
+    expect.scheduled[index] = true;
+    return wheel.isScheduled(index);
+}
+
+bool testStart(const uint32 start)
+{
+    Wheel wheel;
+    Expect expect = {};
+    uint32 now = start;
+    wheel.init(now);
+
+    // Each level boundary (64ms, 4s, 4.5 minutes) and around it
+    const uint32 delays[] = { 0, 1, 2, 62, 63, 64, 65, 127, 128, 129, 4031, 4095, 4096, 4097, 4160, 262143, 262144, 262145, 266240, 300000 };
+    for (uint32 i = 0; i < sizeof(delays) / sizeof(*delays); i++)
+        if (!schedule(wheel, expect, i, now + delays[i])) return false;
+
+    // Some are cancelled and must never expire
+    wheel.cancel(3); expect.scheduled[3] = false;
+    wheel.cancel(12); expect.scheduled[12] = false;
+    if (wheel.isScheduled(3) || wheel.isScheduled(12)) { fprintf(stderr, "Failed test for cancel\n"); return false; }
+    // Some are rescheduled
+    if (!schedule(wheel, expect, 5, now + 5000)) return false;
+    if (!schedule(wheel, expect, 17, now + 10)) return false;
+
+    if (!runUntil(wheel, expect, now, start + 200000)) return false;
+    // Scheduling while some time is processed, from any position in the turns
+    for (uint32 i = 30; i < 40; i++)
+        if (!schedule(wheel, expect, i, now + (i - 30) * 97 + 61)) return false;
+    if (!runUntil(wheel, expect, now, start + 400000)) return false;
+
+    for (uint32 i = 0; i < 64; i++)
+        if (expect.scheduled[i] || wheel.isScheduled(i)) { fprintf(stderr, "Failed test for pending timer (%u)\n", i); return false; }
+    return true;
+}
+
+// A deadline for now, once the wheel is advanced to now, must expire on the next advance at the same time
+bool testLate(const uint32 start)
+{
+    Wheel wheel;
+    wheel.init(start);
+    uint32 count = 0;
+    wheel.advance(start + 10, [&](uint32) { ++count; });
+    wheel.schedule(1, start + 10);
+    wheel.schedule(2, start + 11);
+    if (!testEqual(0, wheel.nextDelay(start + 10, 1000), "next delay of a late timer", 1)) return false;
+    wheel.advance(start + 10, [&](uint32 index) { count += index; });
+    if (!testEqual(1, count, "late timer expiration", 1)) return false;
+    if (!testEqual(1, wheel.nextDelay(start + 10, 1000), "next delay after a late timer", 2)) return false;
+    wheel.advance(start + 11, [&](uint32 index) { count += index; });
+    return testEqual(3, count, "timer after a late timer", 2);
+}
+
+// Random timers, with the time moving by random steps
+bool testRandom(const uint32 start, const unsigned seed)
+{
+    srand(seed);
+    Wheel wheel;
+    Expect expect = {};
+    uint32 now = start;
+    wheel.init(now);
+    for (uint32 round = 0; round < 2000; round++)
+    {
+        const uint32 index = (uint32)rand() % 64;
+        switch (rand() % 4)
+        {
+        case 0: wheel.cancel(index); expect.scheduled[index] = false; break;
+        case 1: if (!schedule(wheel, expect, index, now + (uint32)rand() % 64)) return false; break;
+        case 2: if (!schedule(wheel, expect, index, now + (uint32)rand() % 5000)) return false; break;
+        default: if (!schedule(wheel, expect, index, now + (uint32)rand() % 300000)) return false; break;
+        }
+        if (!runUntil(wheel, expect, now, now + (uint32)rand() % 3000 + 1)) return false;
+    }
+    return runUntil(wheel, expect, now, now + 300001);
+}
+
+int main()
+{
+    // Starting anywhere, at a level boundary and right before the 32 bits time wraps around
+    const uint32 starts[] = { 0, 1000, 63, 4095, 262143, 0xFFFFFFFF - 100, 0xFFFFFFFF - 4096, 0xFFFFFFFF - 262144, 0xFFFFFFFF };
+    for (uint32 i = 0; i < sizeof(starts) / sizeof(*starts); i++)
+    {
+        if (!testStart(starts[i])) { fprintf(stderr, "Failed starting at %u\n", starts[i]); return 1; }
+        if (!testLate(starts[i])) { fprintf(stderr, "Failed starting at %u\n", starts[i]); return 1; }
+        if (!testRandom(starts[i], i)) { fprintf(stderr, "Failed starting at %u\n", starts[i]); return 1; }
+    }
+
+    printf("OK\n");
+    return 0;
+}